@@ -0,0 +1,113 @@
+#pragma once
+#include <stdbool.h>
+
+#include "common.h"
+
+// NOTE: These only promise acquire loads, release stores and sequentially
+// consistent read-modify-writes on x86/x64, which is all we target.
+#ifdef _WIN32
+#include <Windows.h>
+#include <intrin.h>
+
+static inline s32 atomic_load_s32(volatile s32 *value) {
+  s32 result = *value;
+  _ReadWriteBarrier();
+  return result;
+}
+
+static inline void atomic_store_s32(volatile s32 *value, s32 new_value) {
+  _ReadWriteBarrier();
+  *value = new_value;
+}
+
+// Returns the value after the add.
+static inline s32 atomic_add_s32(volatile s32 *value, s32 addend) {
+  return InterlockedExchangeAdd((volatile LONG *)value, addend) + addend;
+}
+
+static inline bool atomic_compare_exchange_s32(volatile s32 *value,
+                                               s32 expected, s32 desired) {
+  return InterlockedCompareExchange((volatile LONG *)value, desired,
+                                    expected) == expected;
+}
+
+// Returns the previous value.
+static inline s32 atomic_exchange_s32(volatile s32 *value, s32 new_value) {
+  return InterlockedExchange((volatile LONG *)value, new_value);
+}
+
+static inline s64 atomic_load_s64(volatile s64 *value) {
+  s64 result = *value;
+  _ReadWriteBarrier();
+  return result;
+}
+
+static inline void atomic_store_s64(volatile s64 *value, s64 new_value) {
+  _ReadWriteBarrier();
+  *value = new_value;
+}
+
+static inline s64 atomic_add_s64(volatile s64 *value, s64 addend) {
+  return InterlockedExchangeAdd64((volatile LONG64 *)value, addend) + addend;
+}
+
+static inline bool atomic_compare_exchange_s64(volatile s64 *value,
+                                               s64 expected, s64 desired) {
+  return InterlockedCompareExchange64((volatile LONG64 *)value, desired,
+                                      expected) == expected;
+}
+
+static inline void atomic_full_barrier() { MemoryBarrier(); }
+
+static inline void cpu_pause() { _mm_pause(); }
+#else
+#include <immintrin.h>
+
+static inline s32 atomic_load_s32(volatile s32 *value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_s32(volatile s32 *value, s32 new_value) {
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+// Returns the value after the add.
+static inline s32 atomic_add_s32(volatile s32 *value, s32 addend) {
+  return __atomic_add_fetch(value, addend, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_compare_exchange_s32(volatile s32 *value,
+                                               s32 expected, s32 desired) {
+  return __atomic_compare_exchange_n(value, &expected, desired, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Returns the previous value.
+static inline s32 atomic_exchange_s32(volatile s32 *value, s32 new_value) {
+  return __atomic_exchange_n(value, new_value, __ATOMIC_SEQ_CST);
+}
+
+static inline s64 atomic_load_s64(volatile s64 *value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_s64(volatile s64 *value, s64 new_value) {
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+static inline s64 atomic_add_s64(volatile s64 *value, s64 addend) {
+  return __atomic_add_fetch(value, addend, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_compare_exchange_s64(volatile s64 *value,
+                                               s64 expected, s64 desired) {
+  return __atomic_compare_exchange_n(value, &expected, desired, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_full_barrier() {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void cpu_pause() { _mm_pause(); }
+#endif
@@ -0,0 +1,338 @@
+#include "./audio.h"
+
+#include <string.h>
+
+#include "../atomics.h"
+#include "../io/file.h"
+#include "../math.h"
+#include "../memory/memory.h"
+
+#define AUDIO_RING_MASK (AUDIO_RING_FRAMES - 1)
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+#pragma pack(push, 1)
+typedef struct WavChunk {
+  u32 id;
+  u32 size;
+} WavChunk;
+
+typedef struct WavFormat {
+  u16 format;
+  u16 channels;
+  u32 sample_rate;
+  u32 bytes_per_second;
+  u16 block_align;
+  u16 bits_per_sample;
+
+  // NOTE: Only present for WAV_FORMAT_EXTENSIBLE, where the real format is in
+  // the first two bytes of the sub format GUID.
+  u16 extension_size;
+  u16 valid_bits_per_sample;
+  u32 channel_mask;
+  u16 sub_format;
+} WavFormat;
+#pragma pack(pop)
+
+static float decode_wav_sample(u8 *sample, u16 format, u16 bits) {
+  if (format == WAV_FORMAT_FLOAT) return *(float *)sample;
+  switch (bits) {
+    case 8:
+      // 8-bit samples are the only unsigned ones.
+      return (sample[0] - 128) / 128.0f;
+    case 16:
+      return *(s16 *)sample / 32768.0f;
+    case 24:
+      return (s32)((u32)sample[0] << 8 | (u32)sample[1] << 16 |
+                   (u32)sample[2] << 24) /
+             2147483648.0f;
+    default:
+      return *(s32 *)sample / 2147483648.0f;
+  }
+}
+
+Sound load_wav(void *memory, size_t size) {
+  u8 *at = (u8 *)memory;
+  u8 *end = at + size;
+  assert(size >= 12);
+  assert(*(u32 *)at == RIFF_ID('R', 'I', 'F', 'F'));
+  assert(*(u32 *)(at + 8) == RIFF_ID('W', 'A', 'V', 'E'));
+  at += 12;
+
+  WavFormat *format = 0;
+  u8 *samples = 0;
+  size_t samples_size = 0;
+  while (at + sizeof(WavChunk) <= end) {
+    WavChunk *chunk = (WavChunk *)at;
+    u8 *data = at + sizeof(WavChunk);
+    // NOTE: Some writers leave the data chunk's size wrong when they are cut
+    // off, so never trust it past the end of the file.
+    size_t chunk_size = chunk->size;
+    if (chunk_size > (size_t)(end - data)) chunk_size = end - data;
+    if (chunk->id == RIFF_ID('f', 'm', 't', ' ')) {
+      format = (WavFormat *)data;
+    } else if (chunk->id == RIFF_ID('d', 'a', 't', 'a')) {
+      samples = data;
+      samples_size = chunk_size;
+    }
+    // Chunks are padded to an even size.
+    at = data + ((chunk_size + 1) & ~(size_t)1);
+  }
+  assert(format && samples);
+
+  u16 encoding = format->format;
+  if (encoding == WAV_FORMAT_EXTENSIBLE) encoding = format->sub_format;
+  u16 bits = format->bits_per_sample;
+  assert((encoding == WAV_FORMAT_PCM &&
+          (bits == 8 || bits == 16 || bits == 24 || bits == 32)) ||
+         (encoding == WAV_FORMAT_FLOAT && bits == 32));
+  // NOTE: These are divisors and loop bounds below, so a broken header has
+  // to stop here rather than divide by zero or read past the samples.
+  assert(format->channels == 1 || format->channels == 2);
+  assert(format->sample_rate > 0);
+  assert(format->block_align >= format->channels * (bits / 8));
+
+  u32 block_align = format->block_align;
+  u32 source_frames = (u32)(samples_size / block_align);
+  assert(source_frames > 0);
+  u32 frame_count = (u32)((u64)source_frames * AUDIO_SAMPLE_RATE /
+                          format->sample_rate);
+  Sound result = allocate_sound(frame_count, format->channels);
+
+  for (u32 channel = 0; channel < format->channels; channel++) {
+    float *dest = channel ? result.right : result.left;
+    u8 *source = samples + channel * (bits / 8);
+    if (format->sample_rate == AUDIO_SAMPLE_RATE) {
+      for (u32 i = 0; i < frame_count; i++) {
+        dest[i] = decode_wav_sample(source + i * block_align, encoding, bits);
+      }
+    } else {
+      // TODO: Linear resampling dulls the top end a little. It is fine for
+      // effects, but music should be saved at AUDIO_SAMPLE_RATE.
+      double step = (double)format->sample_rate / AUDIO_SAMPLE_RATE;
+      for (u32 i = 0; i < frame_count; i++) {
+        double t = i * step;
+        u32 index = (u32)t;
+        u32 next = index + 1 < source_frames ? index + 1 : index;
+        float a =
+            decode_wav_sample(source + index * block_align, encoding, bits);
+        float b =
+            decode_wav_sample(source + next * block_align, encoding, bits);
+        dest[i] = a + (float)(t - index) * (b - a);
+      }
+    }
+  }
+  return result;
+}
+
+Sound load_sound(char *filename) {
+  LoadedFile file = win32_load_file(filename);
+  assert(file.size > 0);
+  Sound result = load_wav(file.memory, file.size);
+  win32_free_file(&file);
+  return result;
+}
+
+Sound allocate_sound(u32 frame_count, u32 channels) {
+  assert(frame_count > 0 && (channels == 1 || channels == 2));
+  // At least a lane of silence after the last frame.
+  u32 stride = (frame_count + 2 * LANE_WIDTH - 1) & ~(LANE_WIDTH - 1);
+  Sound result = {.frame_count = frame_count};
+  result.memory = mem_virtual_alloc(MEMORY_TAG_AUDIO,
+                                    channels * stride * sizeof(float));
+  assert(result.memory);
+  result.left = (float *)result.memory;
+  result.right = channels == 2 ? result.left + stride : result.left;
+  return result;
+}
+
+void free_sound(Sound *sound) {
+  mem_virtual_free(sound->memory);
+  *sound = (Sound){0};
+}
+
+void init_audio(Audio *audio) {
+  size_t ring_size = AUDIO_RING_FRAMES * sizeof(u32);
+  size_t mix_size = (AUDIO_MIX_FRAMES + LANE_WIDTH) * sizeof(float);
+  char *memory =
+      (char *)mem_virtual_alloc(MEMORY_TAG_AUDIO, ring_size + 2 * mix_size);
+  assert(memory);
+  *audio = (Audio){
+      .master_volume = 1.0f,
+      .ring = {.frames = (u32 *)memory},
+      .mix_left = (float *)(memory + ring_size),
+      .mix_right = (float *)(memory + ring_size + mix_size),
+      .memory = memory,
+  };
+}
+
+void free_audio(Audio *audio) {
+  mem_virtual_free(audio->memory);
+  *audio = (Audio){0};
+}
+
+u32 play_sound(Audio *audio, Sound *sound, float volume, float pan,
+               bool loop) {
+  assert(sound->frame_count > 0);
+  for (u32 i = 0; i < AUDIO_MAX_VOICES; i++) {
+    Voice *voice = &audio->voices[i];
+    if (voice->active) continue;
+    *voice = (Voice){
+        .sound = sound,
+        .volume = volume,
+        .pan = pan,
+        .loop = loop,
+        .active = true,
+        .generation = voice->generation + 1,
+    };
+    // NOTE: Index plus one, so 0 is never a valid id.
+    return (u32)voice->generation << 16 | (i + 1);
+  }
+  return 0;
+}
+
+static Voice *find_voice(Audio *audio, u32 id) {
+  u32 index = (id & 0xFFFF) - 1;
+  if (index >= AUDIO_MAX_VOICES) return 0;
+  Voice *voice = &audio->voices[index];
+  if (!voice->active || voice->generation != id >> 16) return 0;
+  return voice;
+}
+
+void set_voice(Audio *audio, u32 id, float volume, float pan) {
+  Voice *voice = find_voice(audio, id);
+  if (!voice) return;
+  voice->volume = volume;
+  voice->pan = pan;
+}
+
+void stop_voice(Audio *audio, u32 id) {
+  Voice *voice = find_voice(audio, id);
+  if (voice) voice->active = false;
+}
+
+// Adds frame_count frames of the voice into left and right, a lane at a time.
+// NOTE: The last lane can run up to LANE_WIDTH - 1 frames past frame_count.
+// Past the end of the sound it only adds its trailing silence, and past the
+// end of the mix it lands in the scratch's padding, so neither needs a tail
+// loop.
+static void mix_voice(Voice *voice, float master_volume, float *left,
+                      float *right, u32 frame_count) {
+  Sound *sound = voice->sound;
+  float volume = voice->volume * master_volume;
+  // Equal power panning, so sounds don't dip in the middle.
+  LaneF32 left_gain =
+      lane_f32(volume * square_root(0.5f * (1.0f - voice->pan)));
+  LaneF32 right_gain =
+      lane_f32(volume * square_root(0.5f * (1.0f + voice->pan)));
+
+  u32 mixed = 0;
+  while (mixed < frame_count && voice->active) {
+    u32 count = sound->frame_count - voice->position;
+    if (count > frame_count - mixed) count = frame_count - mixed;
+    float *source_left = sound->left + voice->position;
+    float *source_right = sound->right + voice->position;
+    float *dest_left = left + mixed;
+    float *dest_right = right + mixed;
+    for (u32 i = 0; i < count; i += LANE_WIDTH) {
+      lane_f32_storeu(
+          dest_left + i,
+          lane_f32_add(lane_f32_loadu(dest_left + i),
+                       lane_f32_mul(lane_f32_loadu(source_left + i),
+                                    left_gain)));
+      lane_f32_storeu(
+          dest_right + i,
+          lane_f32_add(lane_f32_loadu(dest_right + i),
+                       lane_f32_mul(lane_f32_loadu(source_right + i),
+                                    right_gain)));
+    }
+    mixed += count;
+    voice->position += count;
+    if (voice->position == sound->frame_count) {
+      voice->position = 0;
+      if (!voice->loop) voice->active = false;
+    }
+  }
+}
+
+// Clamps to [-1, 1] and packs 4 frames at a time into interleaved 16-bit
+// stereo.
+static void convert_to_s16(float *left, float *right, u32 *frames,
+                           u32 frame_count) {
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 minus_one = _mm_set1_ps(-1.0f);
+  __m128 scale = _mm_set1_ps(32767.0f);
+  u32 i = 0;
+  for (; i + 4 <= frame_count; i += 4) {
+    __m128 l = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(left + i), minus_one), one);
+    __m128 r = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(right + i), minus_one), one);
+    // l0 l1 l2 l3 r0 r1 r2 r3, then interleaved to l0 r0 l1 r1 ...
+    __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(l, scale)),
+                                     _mm_cvtps_epi32(_mm_mul_ps(r, scale)));
+    _mm_storeu_si128((__m128i *)(frames + i),
+                     _mm_unpacklo_epi16(packed, _mm_srli_si128(packed, 8)));
+  }
+  for (; i < frame_count; i++) {
+    float l = MIN(MAX(left[i], -1.0f), 1.0f) * 32767.0f;
+    float r = MIN(MAX(right[i], -1.0f), 1.0f) * 32767.0f;
+    s16 l16 = (s16)(l < 0.0f ? l - 0.5f : l + 0.5f);
+    s16 r16 = (s16)(r < 0.0f ? r - 0.5f : r + 0.5f);
+    frames[i] = (u16)l16 | (u32)(u16)r16 << 16;
+  }
+}
+
+void mix_audio(Audio *audio, u32 *frames, u32 frame_count) {
+  size_t mix_size = (AUDIO_MIX_FRAMES + LANE_WIDTH) * sizeof(float);
+  while (frame_count) {
+    u32 count = MIN(frame_count, AUDIO_MIX_FRAMES);
+    memset(audio->mix_left, 0, mix_size);
+    memset(audio->mix_right, 0, mix_size);
+    for (u32 i = 0; i < AUDIO_MAX_VOICES; i++) {
+      Voice *voice = &audio->voices[i];
+      if (!voice->active) continue;
+      mix_voice(voice, audio->master_volume, audio->mix_left, audio->mix_right,
+                count);
+    }
+    convert_to_s16(audio->mix_left, audio->mix_right, frames, count);
+    frames += count;
+    frame_count -= count;
+  }
+}
+
+u32 audio_ring_count(AudioRing *ring) {
+  return (u32)atomic_load_s32(&ring->write) - (u32)atomic_load_s32(&ring->read);
+}
+
+u32 update_audio(Audio *audio, float seconds_per_frame) {
+  AudioRing *ring = &audio->ring;
+  u32 target =
+      (u32)(AUDIO_LATENCY_FRAMES * seconds_per_frame * AUDIO_SAMPLE_RATE);
+  if (target > AUDIO_RING_FRAMES) target = AUDIO_RING_FRAMES;
+  u32 queued = audio_ring_count(ring);
+  if (queued >= target) return 0;
+
+  // NOTE: Only ever mixing up to the target is what bounds latency. A sound
+  // started now plays as soon as what is already queued has drained.
+  u32 count = target - queued;
+  u32 write = (u32)ring->write;
+  u32 start = write & AUDIO_RING_MASK;
+  u32 first = MIN(count, AUDIO_RING_FRAMES - start);
+  mix_audio(audio, ring->frames + start, first);
+  mix_audio(audio, ring->frames, count - first);
+  atomic_store_s32(&ring->write, (s32)(write + count));
+  return count;
+}
+
+u32 audio_ring_read(AudioRing *ring, u32 *frames, u32 frame_count) {
+  u32 read = (u32)ring->read;
+  u32 count = (u32)atomic_load_s32(&ring->write) - read;
+  if (count > frame_count) count = frame_count;
+  u32 start = read & AUDIO_RING_MASK;
+  u32 first = MIN(count, AUDIO_RING_FRAMES - start);
+  memcpy(frames, ring->frames + start, first * sizeof(u32));
+  memcpy(frames + first, ring->frames, (count - first) * sizeof(u32));
+  atomic_store_s32(&ring->read, (s32)(read + count));
+  return count;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../common.h"
+
+// Everything is mixed at this rate, and sounds are resampled to it when they
+// load so voices never resample while mixing.
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_MAX_VOICES 128
+// Stereo frames the ring can hold. Has to be a power of two.
+#define AUDIO_RING_FRAMES 8192
+// Voices are summed this many frames at a time.
+#define AUDIO_MIX_FRAMES 512
+// How many game frames of sound update_audio keeps queued ahead of the
+// output. This plus the output's own buffering is the latency.
+#define AUDIO_LATENCY_FRAMES 2
+
+// Chunk ids in RIFF files like WAV.
+#define RIFF_ID(a, b, c, d) \
+  ((u32)(a) | (u32)(b) << 8 | (u32)(c) << 16 | (u32)(d) << 24)
+
+// Sounds are preconverted to float at AUDIO_SAMPLE_RATE, one array per
+// channel, so mixing is a multiply-add with no format or rate conversion.
+typedef struct Sound {
+  u32 frame_count;
+  // NOTE: right is the same array as left for mono sounds. Both are followed
+  // by silence up to a multiple of LANE_WIDTH, so the mixer can read whole
+  // lanes past the end.
+  float* left;
+  float* right;
+  void* memory;
+} Sound;
+
+typedef struct Voice {
+  Sound* sound;
+  u32 position;
+  float volume;
+  // -1 is hard left, 1 is hard right.
+  float pan;
+  bool loop;
+  bool active;
+  // Bumped every time the voice is reused, so stale ids can be told apart.
+  u16 generation;
+} Voice;
+
+// Single producer, single consumer queue of interleaved 16-bit stereo frames.
+// The game thread mixes into it and the output drains it, without locks.
+typedef struct AudioRing {
+  // Left sample in the low 16 bits, which is the interleaved order on disk and
+  // in the device.
+  u32* frames;
+  // Free running frame counts. Only the game writes write and only the output
+  // writes read, and write - read is how many frames are queued.
+  volatile s32 write;
+  volatile s32 read;
+} AudioRing;
+
+typedef struct Audio {
+  Voice voices[AUDIO_MAX_VOICES];
+  float master_volume;
+  AudioRing ring;
+  // Float scratch the voices are summed into before it goes in the ring.
+  float* mix_left;
+  float* mix_right;
+  void* memory;
+} Audio;
+
+// Parses a RIFF WAVE file already in memory. Handles 8, 16, 24 and 32-bit
+// integer PCM and 32-bit float, mono or stereo.
+Sound load_wav(void* memory, size_t size);
+
+Sound load_sound(char* filename);
+
+// A silent sound to synthesize into. Mono when channels is 1.
+Sound allocate_sound(u32 frame_count, u32 channels);
+
+void free_sound(Sound* sound);
+
+void init_audio(Audio* audio);
+
+void free_audio(Audio* audio);
+
+// Starts sound on a free voice and returns the voice's id, or 0 when every
+// voice is busy.
+u32 play_sound(Audio* audio, Sound* sound, float volume, float pan, bool loop);
+
+// Does nothing if the voice has already finished.
+void set_voice(Audio* audio, u32 voice, float volume, float pan);
+
+void stop_voice(Audio* audio, u32 voice);
+
+// Sums every playing voice into frames interleaved 16-bit stereo frames.
+void mix_audio(Audio* audio, u32* frames, u32 frame_count);
+
+// Mixes just enough to keep AUDIO_LATENCY_FRAMES game frames queued in the
+// ring. Call once a frame. Returns the number of frames mixed.
+u32 update_audio(Audio* audio, float seconds_per_frame);
+
+// Frames queued in the ring and not yet taken by the output.
+u32 audio_ring_count(AudioRing* ring);
+
+// Called by the output. Copies up to frame_count frames out of the ring and
+// returns how many there were.
+u32 audio_ring_read(AudioRing* ring, u32* frames, u32 frame_count);
@@ -0,0 +1,176 @@
+#include "./output.h"
+
+#include <string.h>
+
+#include "../atomics.h"
+#include "../memory/memory.h"
+
+#pragma pack(push, 1)
+typedef struct WavFileHeader {
+  u32 riff_id;
+  u32 riff_size;
+  u32 wave_id;
+  u32 format_id;
+  u32 format_size;
+  u16 format;
+  u16 channels;
+  u32 sample_rate;
+  u32 bytes_per_second;
+  u16 block_align;
+  u16 bits_per_sample;
+  u32 data_id;
+  u32 data_size;
+} WavFileHeader;
+#pragma pack(pop)
+
+static void write_wav_header(FILE *file, u32 frame_count) {
+  u32 data_size = frame_count * sizeof(u32);
+  WavFileHeader header = {
+      .riff_id = RIFF_ID('R', 'I', 'F', 'F'),
+      .riff_size = sizeof(header) - 8 + data_size,
+      .wave_id = RIFF_ID('W', 'A', 'V', 'E'),
+      .format_id = RIFF_ID('f', 'm', 't', ' '),
+      .format_size = 16,
+      .format = 1,
+      .channels = 2,
+      .sample_rate = AUDIO_SAMPLE_RATE,
+      .bytes_per_second = AUDIO_SAMPLE_RATE * sizeof(u32),
+      .block_align = sizeof(u32),
+      .bits_per_sample = 16,
+      .data_id = RIFF_ID('d', 'a', 't', 'a'),
+      .data_size = data_size,
+  };
+  fwrite(&header, sizeof(header), 1, file);
+}
+
+void open_null_audio_output(AudioOutput *output, AudioRing *ring) {
+  *output = (AudioOutput){.kind = AUDIO_OUTPUT_NULL, .ring = ring};
+}
+
+bool open_wav_audio_output(AudioOutput *output, AudioRing *ring,
+                           char *filename) {
+  *output = (AudioOutput){.kind = AUDIO_OUTPUT_WAV, .ring = ring};
+#ifdef _WIN32
+  if (fopen_s(&output->file, filename, "wb")) output->file = 0;
+#else
+  output->file = fopen(filename, "wb");
+#endif
+  if (!output->file) return false;
+  // NOTE: The sizes are filled in when the output is closed.
+  write_wav_header(output->file, 0);
+  return true;
+}
+
+#ifdef _WIN32
+static void fill_device_block(AudioOutput *output, WAVEHDR *block) {
+  u32 *frames = (u32 *)block->lpData;
+  u32 count = audio_ring_read(output->ring, frames, AUDIO_DEVICE_BLOCK_FRAMES);
+  // NOTE: The game fell behind. Play silence rather than stall the device, and
+  // pick the ring back up next block.
+  memset(frames + count, 0,
+         (AUDIO_DEVICE_BLOCK_FRAMES - count) * sizeof(u32));
+  waveOutWrite(output->device, block, sizeof(*block));
+}
+
+static DWORD WINAPI audio_device_thread_proc(LPVOID parameter) {
+  AudioOutput *output = (AudioOutput *)parameter;
+  while (true) {
+    // The event is signaled whenever the device finishes a block, but several
+    // blocks can finish before we get here.
+    WaitForSingleObject(output->block_done, INFINITE);
+    if (!atomic_load_s32(&output->running)) break;
+    for (u32 i = 0; i < AUDIO_DEVICE_BLOCKS; i++) {
+      WAVEHDR *block = &output->blocks[i];
+      if (block->dwFlags & WHDR_DONE) fill_device_block(output, block);
+    }
+  }
+  return 0;
+}
+
+bool win32_open_audio_device(AudioOutput *output, AudioRing *ring) {
+  *output = (AudioOutput){.kind = AUDIO_OUTPUT_DEVICE, .ring = ring};
+  WAVEFORMATEX format = {
+      .wFormatTag = WAVE_FORMAT_PCM,
+      .nChannels = 2,
+      .nSamplesPerSec = AUDIO_SAMPLE_RATE,
+      .nAvgBytesPerSec = AUDIO_SAMPLE_RATE * sizeof(u32),
+      .nBlockAlign = sizeof(u32),
+      .wBitsPerSample = 16,
+  };
+  output->block_done = CreateEventA(0, FALSE, FALSE, 0);
+  assert(output->block_done);
+  if (waveOutOpen(&output->device, WAVE_MAPPER, &format,
+                  (DWORD_PTR)output->block_done, 0,
+                  CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+    CloseHandle(output->block_done);
+    return false;
+  }
+
+  u32 block_size = AUDIO_DEVICE_BLOCK_FRAMES * sizeof(u32);
+  output->block_memory = (u32 *)mem_virtual_alloc(
+      MEMORY_TAG_AUDIO, AUDIO_DEVICE_BLOCKS * block_size);
+  assert(output->block_memory);
+  for (u32 i = 0; i < AUDIO_DEVICE_BLOCKS; i++) {
+    WAVEHDR *block = &output->blocks[i];
+    block->lpData =
+        (LPSTR)(output->block_memory + i * AUDIO_DEVICE_BLOCK_FRAMES);
+    block->dwBufferLength = block_size;
+    waveOutPrepareHeader(output->device, block, sizeof(*block));
+    // Starts the device on silence, since nothing has been mixed yet.
+    fill_device_block(output, block);
+  }
+
+  output->running = 1;
+  output->thread =
+      CreateThread(0, 0, audio_device_thread_proc, output, 0, 0);
+  assert(output->thread);
+  // NOTE: A late block is an audible click, a late frame usually isn't.
+  SetThreadPriority(output->thread, THREAD_PRIORITY_TIME_CRITICAL);
+  return true;
+}
+#endif
+
+void pump_audio_output(AudioOutput *output, u32 frame_count) {
+  if (output->kind == AUDIO_OUTPUT_DEVICE) return;
+  u32 frames[AUDIO_MIX_FRAMES];
+  while (frame_count) {
+    u32 count = audio_ring_read(output->ring, frames,
+                                MIN(frame_count, AUDIO_MIX_FRAMES));
+    if (!count) break;
+    if (output->kind == AUDIO_OUTPUT_WAV) {
+      fwrite(frames, sizeof(u32), count, output->file);
+      output->frames_written += count;
+    }
+    frame_count -= count;
+  }
+}
+
+void close_audio_output(AudioOutput *output) {
+  switch (output->kind) {
+    case AUDIO_OUTPUT_WAV: {
+      fseek(output->file, 0, SEEK_SET);
+      write_wav_header(output->file, output->frames_written);
+      fclose(output->file);
+    } break;
+#ifdef _WIN32
+    case AUDIO_OUTPUT_DEVICE: {
+      atomic_store_s32(&output->running, 0);
+      SetEvent(output->block_done);
+      WaitForSingleObject(output->thread, INFINITE);
+      CloseHandle(output->thread);
+      // Hands every queued block back so they can be unprepared.
+      waveOutReset(output->device);
+      for (u32 i = 0; i < AUDIO_DEVICE_BLOCKS; i++) {
+        waveOutUnprepareHeader(output->device, &output->blocks[i],
+                               sizeof(WAVEHDR));
+      }
+      waveOutClose(output->device);
+      CloseHandle(output->block_done);
+      mem_virtual_free(output->block_memory);
+    } break;
+#endif
+    default:
+      break;
+  }
+  *output = (AudioOutput){0};
+}
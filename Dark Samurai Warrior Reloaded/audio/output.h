@@ -0,0 +1,59 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "./audio.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <mmsystem.h>
+
+// waveOut plays blocks of this many frames, and keeps this many queued. The
+// device adds about AUDIO_DEVICE_BLOCKS * 5.3 ms on top of the ring.
+#define AUDIO_DEVICE_BLOCK_FRAMES 256
+#define AUDIO_DEVICE_BLOCKS 3
+#endif
+
+typedef enum AudioOutputKind {
+  // Throws the sound away. For headless runs and machines with no device.
+  AUDIO_OUTPUT_NULL,
+  // Writes everything played to a 16-bit stereo WAV file.
+  AUDIO_OUTPUT_WAV,
+  AUDIO_OUTPUT_DEVICE,
+} AudioOutputKind;
+
+// Drains an Audio's ring. The device has a thread that pulls from the ring at
+// the device's pace, the null and WAV outputs have no clock so the game pumps
+// them instead.
+typedef struct AudioOutput {
+  AudioOutputKind kind;
+  AudioRing* ring;
+  // For AUDIO_OUTPUT_WAV.
+  FILE* file;
+  u32 frames_written;
+#ifdef _WIN32
+  HWAVEOUT device;
+  WAVEHDR blocks[AUDIO_DEVICE_BLOCKS];
+  u32* block_memory;
+  HANDLE block_done;
+  HANDLE thread;
+  volatile s32 running;
+#endif
+} AudioOutput;
+
+void open_null_audio_output(AudioOutput* output, AudioRing* ring);
+
+// Returns false if the file can't be created.
+bool open_wav_audio_output(AudioOutput* output, AudioRing* ring,
+                           char* filename);
+
+#ifdef _WIN32
+// Returns false if there is no device to open.
+bool win32_open_audio_device(AudioOutput* output, AudioRing* ring);
+#endif
+
+// Takes frame_count frames out of the ring, as though that much time had
+// passed on the output. Does nothing for a device, which keeps its own time.
+void pump_audio_output(AudioOutput* output, u32 frame_count);
+
+void close_audio_output(AudioOutput* output);
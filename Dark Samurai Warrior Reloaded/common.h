@@ -21,8 +21,13 @@
 
 #define BYTES_PER_PIXEL 4
 
-inline u32 bitscan_forward(u32 mask) {
-  u64 result = 0;
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline u32 bitscan_forward(u32 mask) {
+  unsigned long result = 0;
   _BitScanForward(&result, mask);
   return result;
-}
\ No newline at end of file
+}
+#else
+static inline u32 bitscan_forward(u32 mask) { return __builtin_ctz(mask); }
+#endif
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "./anim.h"
+
+#include <float.h>
+#include <string.h>
+
+#include "../../memory/memory.h"
+
+// Splits one row of pixels into opaque and translucent spans, skipping fully
+// transparent pixels. Only counts them when spans is null.
+static u32 build_row_spans(u32 *pixels, int width, SpriteSpan *spans) {
+  u32 count = 0;
+  int x = 0;
+  while (x < width) {
+    u32 alpha = pixels[x] >> 24;
+    if (!alpha) {
+      x++;
+      continue;
+    }
+    bool opaque = alpha == 0xFF;
+    int start = x;
+    while (x < width) {
+      alpha = pixels[x] >> 24;
+      if (!alpha || (alpha == 0xFF) != opaque) break;
+      x++;
+    }
+    if (spans) {
+      spans[count] = (SpriteSpan){
+          .x = (u16)start, .length = (u16)(x - start), .opaque = opaque};
+    }
+    count++;
+  }
+  return count;
+}
+
+static u32 *frame_pixels(SpriteSheet *sheet, SpriteFrame *frame, int row) {
+  return (u32 *)((char *)sheet->bitmap.memory +
+                 frame->x * BYTES_PER_PIXEL +
+                 (frame->y + row) * sheet->bitmap.pitch);
+}
+
+// NOTE: The bitmap is bottom-up, so the first row of frames in the image is at
+// the top of the bitmap.
+static SpriteFrame frame_at(SpriteSheet *sheet, u32 index, int columns) {
+  SpriteFrame result = {
+      .x = (index % columns) * sheet->frame_width,
+      .y = sheet->bitmap.height - (index / columns + 1) * sheet->frame_height,
+  };
+  return result;
+}
+
+SpriteSheet load_sprite_sheet(char *filename, int frame_width,
+                              int frame_height, float frame_duration) {
+  assert(frame_duration > 0.0f);
+  SpriteSheet result = {
+      .bitmap = load_bitmap(filename),
+      .frame_width = frame_width,
+      .frame_height = frame_height,
+  };
+  // Spans store x and length in 16 bits.
+  assert(frame_width > 0 && frame_width <= UINT16_MAX);
+  int columns = result.bitmap.width / frame_width;
+  int rows = result.bitmap.height / frame_height;
+  result.frame_count = columns * rows;
+  assert(result.frame_count > 0);
+
+  // Count the spans first so everything fits in one allocation.
+  u32 span_count = 0;
+  for (u32 i = 0; i < result.frame_count; i++) {
+    SpriteFrame frame = frame_at(&result, i, columns);
+    for (int y = 0; y < frame_height; y++) {
+      span_count += build_row_spans(frame_pixels(&result, &frame, y),
+                                    frame_width, 0);
+    }
+  }
+
+  size_t frames_size = result.frame_count * sizeof(SpriteFrame);
+  size_t rows_size = result.frame_count * (frame_height + 1) * sizeof(u32);
+  size_t spans_size = span_count * sizeof(SpriteSpan);
+  result.memory =
+      mem_alloc(MEMORY_TAG_RENDER, frames_size + rows_size + spans_size);
+  assert(result.memory);
+  result.frames = (SpriteFrame *)result.memory;
+  u32 *row_spans = (u32 *)((char *)result.memory + frames_size);
+  result.spans = (SpriteSpan *)((char *)row_spans + rows_size);
+
+  u32 span = 0;
+  for (u32 i = 0; i < result.frame_count; i++) {
+    SpriteFrame *frame = &result.frames[i];
+    *frame = frame_at(&result, i, columns);
+    frame->duration = frame_duration;
+    frame->rows = row_spans + i * (frame_height + 1);
+    frame->opaque = true;
+    for (int y = 0; y < frame_height; y++) {
+      frame->rows[y] = span;
+      u32 count = build_row_spans(frame_pixels(&result, frame, y),
+                                  frame_width, result.spans + span);
+      SpriteSpan *first = &result.spans[span];
+      if (count != 1 || !first->opaque || first->length != frame_width) {
+        frame->opaque = false;
+      }
+      span += count;
+    }
+    frame->rows[frame_height] = span;
+  }
+  return result;
+}
+
+void free_sprite_sheet(SpriteSheet *sheet) {
+  free_bitmap(&sheet->bitmap);
+  mem_free(sheet->memory);
+  sheet->memory = 0;
+  sheet->frames = 0;
+  sheet->spans = 0;
+  sheet->frame_count = 0;
+}
+
+u32 add_sprite_animation(SpriteSheet *sheet, u32 first_frame,
+                         u32 frame_count, float frame_duration, bool loop) {
+  assert(sheet->animation_count < SPRITE_MAX_ANIMATIONS);
+  assert(frame_count > 0 && first_frame + frame_count <= sheet->frame_count);
+  assert(frame_duration > 0.0f);
+  for (u32 i = first_frame; i < first_frame + frame_count; i++) {
+    sheet->frames[i].duration = frame_duration;
+  }
+  u32 result = sheet->animation_count++;
+  sheet->animations[result] = (SpriteAnimation){
+      .first_frame = (u16)first_frame,
+      .frame_count = (u16)frame_count,
+      .loop = loop,
+  };
+  return result;
+}
+
+void draw_sprite_frame(LoadedBitmap *buffer, SpriteSheet *sheet, u32 frame,
+                       int x, int y) {
+  SpriteFrame *sprite = &sheet->frames[frame];
+  int min_x = MAX(x, 0);
+  int min_y = MAX(y, 0);
+  int max_x = MIN(x + sheet->frame_width, buffer->width);
+  int max_y = MIN(y + sheet->frame_height, buffer->height);
+  if (min_x >= max_x || min_y >= max_y) return;
+
+  char *dest_row = (char *)buffer->memory + min_y * buffer->pitch;
+  for (int row = min_y - y; row < max_y - y; row++) {
+    u32 *source = frame_pixels(sheet, sprite, row);
+    u32 *dest = (u32 *)dest_row;
+    if (sprite->opaque) {
+      memcpy(dest + min_x, source + (min_x - x),
+             (max_x - min_x) * BYTES_PER_PIXEL);
+    } else {
+      for (u32 i = sprite->rows[row]; i < sprite->rows[row + 1]; i++) {
+        SpriteSpan *span = &sheet->spans[i];
+        int start = MAX(x + span->x, min_x);
+        int end = MIN(x + span->x + span->length, max_x);
+        if (start >= end) continue;
+        if (span->opaque) {
+          memcpy(dest + start, source + (start - x),
+                 (end - start) * BYTES_PER_PIXEL);
+        } else {
+          blend_pixels(dest + start, source + (start - x), end - start);
+        }
+      }
+    }
+    dest_row += buffer->pitch;
+  }
+}
+
+void init_animation_table(AnimationTable *table, SpriteSheet *sheet,
+                          u32 capacity) {
+  capacity = (capacity + LANE_WIDTH - 1) & ~(LANE_WIDTH - 1);
+  // time_left, speed, x and y are 4 bytes, animation and frame are 2.
+  char *memory = (char *)mem_virtual_alloc(
+      MEMORY_TAG_RENDER, capacity * (4 * sizeof(u32) + 2 * sizeof(u16)));
+  assert(memory);
+  *table = (AnimationTable){
+      .sheet = sheet,
+      .capacity = capacity,
+      .time_left = (float *)memory,
+      .speed = (float *)memory + capacity,
+      .x = (s32 *)memory + 2 * capacity,
+      .y = (s32 *)memory + 3 * capacity,
+      .animation = (u16 *)((s32 *)memory + 4 * capacity),
+      .memory = memory,
+  };
+  table->frame = table->animation + capacity;
+}
+
+void free_animation_table(AnimationTable *table) {
+  mem_virtual_free(table->memory);
+  table->memory = 0;
+  table->count = 0;
+  table->capacity = 0;
+}
+
+void play_animation(AnimationTable *table, u32 index, u32 animation) {
+  assert(index < table->count && animation < table->sheet->animation_count);
+  u32 frame = table->sheet->animations[animation].first_frame;
+  table->animation[index] = (u16)animation;
+  table->frame[index] = (u16)frame;
+  table->time_left[index] = table->sheet->frames[frame].duration;
+}
+
+s32 add_animation_instance(AnimationTable *table, u32 animation, int x,
+                           int y) {
+  if (table->count == table->capacity) return -1;
+  u32 index = table->count++;
+  table->speed[index] = 1.0f;
+  table->x[index] = x;
+  table->y[index] = y;
+  play_animation(table, index, animation);
+  return index;
+}
+
+void remove_animation_instance(AnimationTable *table, u32 index) {
+  assert(index < table->count);
+  u32 last = --table->count;
+  table->time_left[index] = table->time_left[last];
+  table->speed[index] = table->speed[last];
+  table->animation[index] = table->animation[last];
+  table->frame[index] = table->frame[last];
+  table->x[index] = table->x[last];
+  table->y[index] = table->y[last];
+}
+
+// Moves an instance whose frame ran out on to the next one, or several if dt
+// was longer than a frame.
+static void advance_frame(AnimationTable *table, u32 index) {
+  SpriteSheet *sheet = table->sheet;
+  SpriteAnimation *animation = &sheet->animations[table->animation[index]];
+  u32 end = animation->first_frame + animation->frame_count;
+  while (table->time_left[index] <= 0.0f) {
+    u32 frame = table->frame[index] + 1;
+    if (frame == end) {
+      if (!animation->loop) {
+        // NOTE: Hold the last frame. FLT_MAX survives any number of updates.
+        table->time_left[index] = FLT_MAX;
+        return;
+      }
+      frame = animation->first_frame;
+    }
+    table->frame[index] = (u16)frame;
+    table->time_left[index] += sheet->frames[frame].duration;
+  }
+}
+
+void update_animations(AnimationTable *table, float dt) {
+  LaneF32 dt_lane = lane_f32(dt);
+  LaneF32 zero = lane_f32(0.0f);
+  for (u32 i = 0; i < table->count; i += LANE_WIDTH) {
+    LaneF32 time_left =
+        lane_f32_sub(lane_f32_load(table->time_left + i),
+                     lane_f32_mul(lane_f32_load(table->speed + i), dt_lane));
+    lane_f32_store(table->time_left + i, time_left);
+
+    // Only instances whose frame ran out this update do any more work.
+    int mask = lane_mask_bits(lane_f32_less_equal(time_left, zero));
+    if (i + LANE_WIDTH > table->count) {
+      mask &= (1 << (table->count - i)) - 1;
+    }
+    while (mask) {
+      u32 lane = bitscan_forward(mask);
+      advance_frame(table, i + lane);
+      mask &= mask - 1;
+    }
+  }
+}
+
+void draw_animations(LoadedBitmap *buffer, AnimationTable *table) {
+  for (u32 i = 0; i < table->count; i++) {
+    draw_sprite_frame(buffer, table->sheet, table->frame[i], table->x[i],
+                      table->y[i]);
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdbool.h>
+
+#include "../../common.h"
+#include "../render.h"
+
+#define SPRITE_MAX_ANIMATIONS 16
+
+// A run of pixels on one row of a frame that are either all opaque, which are
+// copied, or all partly transparent, which are blended. Fully transparent
+// pixels have no span and are never touched.
+typedef struct SpriteSpan {
+  u16 x;
+  u16 length;
+  bool opaque;
+} SpriteSpan;
+
+typedef struct SpriteFrame {
+  // Bottom left corner of the frame in the sheet.
+  int x;
+  int y;
+  float duration;
+  // rows[y] to rows[y + 1] index the spans of row y, bottom-up.
+  u32* rows;
+  // Every pixel is opaque, so rows are copied whole.
+  bool opaque;
+} SpriteFrame;
+
+typedef struct SpriteAnimation {
+  u16 first_frame;
+  u16 frame_count;
+  bool loop;
+} SpriteAnimation;
+
+// NOTE: The sheet's pixels are one bitmap, and the frame table, row table and
+// spans are one more allocation, no matter how many frames there are.
+typedef struct SpriteSheet {
+  LoadedBitmap bitmap;
+  int frame_width;
+  int frame_height;
+  u32 frame_count;
+  SpriteFrame* frames;
+  SpriteSpan* spans;
+  SpriteAnimation animations[SPRITE_MAX_ANIMATIONS];
+  u32 animation_count;
+  void* memory;
+} SpriteSheet;
+
+// Every instance of an animation table plays from the same sheet. Instances
+// are stored struct-of-arrays like particles, with capacity rounded up to
+// LANE_WIDTH so frame timers can be advanced a lane at a time.
+typedef struct AnimationTable {
+  SpriteSheet* sheet;
+  u32 count;
+  u32 capacity;
+  // Seconds left in the current frame.
+  float* time_left;
+  float* speed;
+  u16* animation;
+  // Index into the sheet's frames, not into the animation.
+  u16* frame;
+  s32* x;
+  s32* y;
+  void* memory;
+} AnimationTable;
+
+// Cuts the sheet into frame_width x frame_height frames, numbered left to
+// right, top to bottom as the image is viewed. Every frame shows for
+// frame_duration seconds until an animation says otherwise.
+SpriteSheet load_sprite_sheet(char* filename, int frame_width,
+                              int frame_height, float frame_duration);
+
+void free_sprite_sheet(SpriteSheet* sheet);
+
+// Adds an animation over frame_count frames from first_frame and returns its
+// index.
+u32 add_sprite_animation(SpriteSheet* sheet, u32 first_frame,
+                         u32 frame_count, float frame_duration, bool loop);
+
+// Blends one frame into the buffer with its bottom left corner at (x, y),
+// clipped to the buffer.
+void draw_sprite_frame(LoadedBitmap* buffer, SpriteSheet* sheet, u32 frame,
+                       int x, int y);
+
+void init_animation_table(AnimationTable* table, SpriteSheet* sheet,
+                          u32 capacity);
+
+void free_animation_table(AnimationTable* table);
+
+// Returns the new instance's index, or -1 when the table is full.
+s32 add_animation_instance(AnimationTable* table, u32 animation, int x, int y);
+
+// Moves the last instance into index, like particles.
+void remove_animation_instance(AnimationTable* table, u32 index);
+
+// Restarts the instance on animation.
+void play_animation(AnimationTable* table, u32 index, u32 animation);
+
+void update_animations(AnimationTable* table, float dt);
+
+void draw_animations(LoadedBitmap* buffer, AnimationTable* table);
@@ -2,149 +2,266 @@
 
 #include <Windows.h>
 
-Glyph win32_get_glyph(Font *font, char *font_name, u32 code_point) {
-  Glyph result = {.bitmap = (LoadedBitmap *)malloc(sizeof(LoadedBitmap))};
-  int max_width = 256;
-  int max_height = 256;
-  HDC dc = 0;
-  TEXTMETRIC text_metric = {0};
-  HBITMAP bitmap = 0;
-  HFONT hfont = 0;
-  VOID *bits = 0;
-  if (!dc) {
-    hfont = CreateFontA(32, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
-                        DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
-                        CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY,
-                        DEFAULT_PITCH | FF_DONTCARE, font_name);
-    assert(hfont);
-    dc = CreateCompatibleDC(GetDC(0));
-    BITMAPINFO info = {
-        .bmiHeader =
-            {
-                .biSize = sizeof(info.bmiHeader),
-                .biWidth = max_width,
-                .biHeight = max_height,
-                .biPlanes = 1,
-                .biBitCount = 32,
-                .biCompression = BI_RGB,
-            },
-    };
-    bitmap = CreateDIBSection(dc, &info, DIB_RGB_COLORS, &bits, 0, 0);
-    SelectObject(dc, bitmap);
-    SelectObject(dc, hfont);
-    SetBkColor(dc, RGB(0, 0, 0));
-    GetTextMetrics(dc, &text_metric);
-  }
+#include "../../memory/memory.h"
+
+// TODO: I am only loading the "drawable" ASCII characters.
+#define FIRST_GLYPH '!'
+#define LAST_GLYPH '~'
+#define MAX_GLYPH_SIZE 256
+// How many glyphs draw_text lays out before blitting them.
+#define TEXT_RUN_LENGTH 256
 
+// GDI state shared by every glyph of the font being loaded.
+typedef struct GlyphRasterizer {
+  HDC dc;
+  TEXTMETRIC text_metric;
+  u32 *bits;
+} GlyphRasterizer;
+
+static SIZE glyph_extent(GlyphRasterizer *rasterizer, u32 code_point) {
   SIZE size;
   wchar_t cheese_point = (wchar_t)code_point;
-  assert(GetTextExtentPoint32W(dc, &cheese_point, 1, &size));
-  int width = MIN(size.cx, max_width);
-  int height = MIN(size.cy, max_height);
-  // TODO: Specify color
-  SetTextColor(dc, RGB(255, 255, 255));
-  assert(TextOut(dc, 0, 0, &cheese_point, 1));
+  assert(GetTextExtentPoint32W(rasterizer->dc, &cheese_point, 1, &size));
+  size.cx = MIN(size.cx, MAX_GLYPH_SIZE);
+  size.cy = MIN(size.cy, MAX_GLYPH_SIZE);
+  return size;
+}
+
+// Draws the glyph into the rasterizer's DIB, then copies the coverage inside
+// its bounding box to *memory and advances it.
+static Glyph win32_get_glyph(Font *font, GlyphRasterizer *rasterizer,
+                             u32 code_point, u8 **memory) {
+  Glyph result = {0};
+  SIZE size = glyph_extent(rasterizer, code_point);
+  wchar_t cheese_point = (wchar_t)code_point;
+  memset(rasterizer->bits, 0,
+         MAX_GLYPH_SIZE * MAX_GLYPH_SIZE * BYTES_PER_PIXEL);
+  assert(TextOutW(rasterizer->dc, 0, 0, &cheese_point, 1));
+  // NOTE: GDI batches drawing, it has to be flushed before we read the bits.
+  GdiFlush();
 
   int max_x = INT16_MIN;
   int max_y = INT16_MIN;
   int min_x = INT16_MAX;
   int min_y = INT16_MAX;
 
-  // NOTE: Preadvancing by max_height - 1 because I want to start at the last
-  // row of the bitmap and go up with each iteration of y.
-  u32 *row = (u32 *)bits + (max_height - 1) * max_width;
+  // NOTE: The DIB is bottom-up, so row y from the top is at
+  // MAX_GLYPH_SIZE - 1 - y.
   // We drew the glyph in a bitmap that is too large for it, now we find the
   // bounding box for the non-zero pixel values.
-  for (int y = 0; y < height; y++) {
-    u32 *pixel = row;
-    for (int x = 0; x < width; x++) {
-      if (*pixel != 0) {
-        max_x = max(max_x, x);
-        max_y = max(max_y, y);
-        min_x = min(min_x, x);
-        min_y = min(min_y, y);
+  for (int y = 0; y < size.cy; y++) {
+    u32 *row = rasterizer->bits + (MAX_GLYPH_SIZE - 1 - y) * MAX_GLYPH_SIZE;
+    for (int x = 0; x < size.cx; x++) {
+      if (row[x] != 0) {
+        max_x = MAX(max_x, x);
+        max_y = MAX(max_y, y);
+        min_x = MIN(min_x, x);
+        min_y = MIN(min_y, y);
       }
-      pixel++;
     }
-    row -= max_width;
   }
+  if (max_x < min_x) return result;
 
-  width = max_x - min_x + 1;
-  height = max_y - min_y + 1;
-
-  result.bitmap->width = width;
-  result.bitmap->height = height;
-  result.bitmap->pitch = result.bitmap->width * BYTES_PER_PIXEL;
-  size_t bitmap_size = width * height * BYTES_PER_PIXEL;
-  result.bitmap->memory = malloc(bitmap_size);
-  memset(result.bitmap->memory, 0, sizeof(bitmap_size));
+  result.width = max_x - min_x + 1;
+  result.height = max_y - min_y + 1;
+  result.pitch = result.width;
+  result.coverage = *memory;
+  *memory += result.pitch * result.height;
 
-  char *dest_row =
-      (char *)result.bitmap->memory + (height - 1) * result.bitmap->pitch;
-  for (int y = min_y; y <= max_y; y++) {
-    u32 *dest = (u32 *)dest_row;
+  // Copy the bottom row of the bounding box first.
+  u8 *dest = result.coverage;
+  for (int y = max_y; y >= min_y; y--) {
+    u32 *source = rasterizer->bits + (MAX_GLYPH_SIZE - 1 - y) * MAX_GLYPH_SIZE;
     for (int x = min_x; x <= max_x; x++) {
       // TODO: cleartype antialiasing
-      COLORREF pixel = GetPixel(dc, x, y);
-      u32 alpha = ((pixel >> 16) & 0xFF);
-
-      u32 color = ((alpha << 24) | (alpha << 16) | (alpha << 8) | (alpha << 0));
-      *dest++ = color;
+      *dest++ = (u8)((source[x] >> 16) & 0xFF);
     }
-    dest_row -= result.bitmap->pitch;
   }
 
   // TODO: Support non mono-spaced fonts. To do this I believe I will need to
   // extract the entire kerning table for the font and store it in some kind of
   // hash table or array of pairs to look up later when drawing the fonts.
   ABC abc;
-  assert(GetCharABCWidthsA(dc, code_point, code_point, &abc));
+  assert(GetCharABCWidthsA(rasterizer->dc, code_point, code_point, &abc));
 
   if (!font->advance_width)
     font->advance_width = abc.abcA + abc.abcB + abc.abcC;
-  if (!font->line_gap)
-    font->line_gap = text_metric.tmHeight + text_metric.tmExternalLeading;
-
-  result.ascent = max_y - (size.cy - text_metric.tmDescent);
-
-  DeleteObject(bitmap);
-  DeleteObject(hfont);
-  if (dc) {
-    DeleteDC(dc);
-    dc = 0;
-  }
 
+  result.ascent = max_y - (size.cy - rasterizer->text_metric.tmDescent);
   return result;
 }
 
 Font win32_load_font(char *font_name) {
   Font result = {0};
-  // TODO: I am only loading the "drawable" ASCII characters.
-  for (char c = '!'; c < '~'; c++) {
-    result.glyphs[c] = win32_get_glyph(&result, font_name, (wchar_t)(c));
+  GlyphRasterizer rasterizer = {0};
+
+  HFONT hfont = CreateFontA(32, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
+                            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+                            CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY,
+                            DEFAULT_PITCH | FF_DONTCARE, font_name);
+  assert(hfont);
+  rasterizer.dc = CreateCompatibleDC(0);
+  BITMAPINFO info = {
+      .bmiHeader =
+          {
+              .biSize = sizeof(info.bmiHeader),
+              .biWidth = MAX_GLYPH_SIZE,
+              .biHeight = MAX_GLYPH_SIZE,
+              .biPlanes = 1,
+              .biBitCount = 32,
+              .biCompression = BI_RGB,
+          },
+  };
+  VOID *bits = 0;
+  HBITMAP bitmap =
+      CreateDIBSection(rasterizer.dc, &info, DIB_RGB_COLORS, &bits, 0, 0);
+  assert(bitmap);
+  rasterizer.bits = (u32 *)bits;
+  SelectObject(rasterizer.dc, bitmap);
+  SelectObject(rasterizer.dc, hfont);
+  SetBkColor(rasterizer.dc, RGB(0, 0, 0));
+  SetTextColor(rasterizer.dc, RGB(255, 255, 255));
+  GetTextMetrics(rasterizer.dc, &rasterizer.text_metric);
+  result.line_gap = rasterizer.text_metric.tmHeight +
+                    rasterizer.text_metric.tmExternalLeading;
+
+  // NOTE: The glyph extents bound the bounding boxes, so one allocation sized
+  // from them holds every glyph's coverage.
+  size_t coverage_size = 0;
+  for (u32 c = FIRST_GLYPH; c <= LAST_GLYPH; c++) {
+    SIZE size = glyph_extent(&rasterizer, c);
+    coverage_size += (size_t)size.cx * size.cy;
   }
+  result.coverage_memory = (u8 *)mem_alloc(MEMORY_TAG_FONT, coverage_size);
+  assert(result.coverage_memory);
+
+  u8 *memory = result.coverage_memory;
+  for (u32 c = FIRST_GLYPH; c <= LAST_GLYPH; c++) {
+    result.glyphs[c] = win32_get_glyph(&result, &rasterizer, c, &memory);
+  }
+
+  DeleteDC(rasterizer.dc);
+  DeleteObject(bitmap);
+  DeleteObject(hfont);
   return result;
 }
 
-void draw_string(LoadedBitmap *buffer, Font *font, u32 x, u32 y, char *string) {
-  char *c = string;
-  Glyph *glyphs = font->glyphs;
-  s32 current_x = x;
-  s32 current_y = y;
-  while (*c) {
-    char character = *c;
-    // TODO: handle newlines
+void free_font(Font *font) {
+  mem_free(font->coverage_memory);
+  memset(font->glyphs, 0, sizeof(font->glyphs));
+  font->coverage_memory = 0;
+}
+
+TextCursor text_cursor(const char *string, int x, int y) {
+  TextCursor result = {.at = string, .line_x = x, .x = x, .y = y};
+  return result;
+}
+
+u32 layout_text(Font *font, TextCursor *cursor, PlacedGlyph *placed,
+                u32 max_count) {
+  u32 count = 0;
+  const char *c = cursor->at;
+  int x = cursor->x;
+  int y = cursor->y;
+  while (*c && count < max_count) {
+    u8 character = (u8)*c++;
     if (character == '\n') {
-      current_y -= font->line_gap;
-      current_x = x;
-      c++;
+      y -= font->line_gap;
+      x = cursor->line_x;
       continue;
     }
-    if (character >= '!' && character <= '~') {
-      Glyph glyph = *(glyphs + character);
-      draw_bitmap(buffer, glyph.bitmap, current_x, current_y - glyph.ascent);
+    if (character < array_length(font->glyphs)) {
+      Glyph *glyph = &font->glyphs[character];
+      // NOTE: Spaces and glyphs that weren't loaded only advance.
+      if (glyph->width) {
+        placed[count++] =
+            (PlacedGlyph){.glyph = glyph, .x = x, .y = y - glyph->ascent};
+      }
     }
-    current_x += font->advance_width;
-    c++;
+    x += font->advance_width;
   }
+  cursor->at = c;
+  cursor->x = x;
+  cursor->y = y;
+  return count;
+}
+
+// Scales the premultiplied color by a 0..255 coverage value.
+static u32 scale_color(u32 color, u32 coverage) {
+  // NOTE: Same trick as blend_premultiplied, two channels at a time.
+  u32 rb = (color & 0x00FF00FF) * coverage + 0x00800080;
+  u32 ag = ((color >> 8) & 0x00FF00FF) * coverage + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+  ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+  return rb | ag;
+}
+
+void draw_glyph_run(LoadedBitmap *buffer, PlacedGlyph *placed, u32 count,
+                    V4 color) {
+  color = v4_clamp01(color);
+  color.r *= color.a;
+  color.g *= color.a;
+  color.b *= color.a;
+  u32 premultiplied = u32_color_from_v4(color);
+  // NOTE: The channels are 0..1, so multiplying by a 0..255 coverage gives
+  // the 0..255 channels of the color scaled by coverage.
+  LaneF32 r = lane_f32(color.r);
+  LaneF32 g = lane_f32(color.g);
+  LaneF32 b = lane_f32(color.b);
+  LaneF32 a = lane_f32(color.a);
+  LaneF32 zero = lane_f32(0.0f);
+
+  for (u32 i = 0; i < count; i++) {
+    Glyph *glyph = placed[i].glyph;
+    int pos_x = placed[i].x;
+    int pos_y = placed[i].y;
+    int min_x = MAX(pos_x, 0);
+    int min_y = MAX(pos_y, 0);
+    int max_x = MIN(pos_x + glyph->width, buffer->width);
+    int max_y = MIN(pos_y + glyph->height, buffer->height);
+    if (min_x >= max_x || min_y >= max_y) continue;
+    int width = max_x - min_x;
+
+    u8 *source_row = glyph->coverage + (min_x - pos_x) +
+                     (min_y - pos_y) * glyph->pitch;
+    char *dest_row = (char *)buffer->memory + min_x * BYTES_PER_PIXEL +
+                     min_y * buffer->pitch;
+    for (int y = min_y; y < max_y; y++) {
+      u8 *source = source_row;
+      u32 *dest = (u32 *)dest_row;
+      int x = 0;
+      for (; x + LANE_WIDTH <= width; x += LANE_WIDTH) {
+        LaneF32 coverage = lane_f32_from_u32(lane_u32_load_u8(source + x));
+        // Most of a glyph's box is empty.
+        if (!lane_mask_bits(lane_f32_greater(coverage, zero))) continue;
+        LaneU32 text = lane_pack_color(
+            lane_f32_mul(r, coverage), lane_f32_mul(g, coverage),
+            lane_f32_mul(b, coverage), lane_f32_mul(a, coverage));
+        lane_u32_storeu(dest + x, lane_blend_premultiplied(
+                                      lane_u32_loadu(dest + x), text));
+      }
+      for (; x < width; x++) {
+        if (!source[x]) continue;
+        dest[x] =
+            blend_premultiplied(dest[x], scale_color(premultiplied, source[x]));
+      }
+      source_row += glyph->pitch;
+      dest_row += buffer->pitch;
+    }
+  }
+}
+
+void draw_text(LoadedBitmap *buffer, Font *font, int x, int y,
+               const char *string, V4 color) {
+  PlacedGlyph placed[TEXT_RUN_LENGTH];
+  TextCursor cursor = text_cursor(string, x, y);
+  while (*cursor.at) {
+    u32 count = layout_text(font, &cursor, placed, TEXT_RUN_LENGTH);
+    draw_glyph_run(buffer, placed, count, color);
+  }
+}
+
+void draw_string(LoadedBitmap *buffer, Font *font, u32 x, u32 y,
+                 const char *string) {
+  draw_text(buffer, font, x, y, string, v4(1.0f, 1.0f, 1.0f, 1.0f));
 }
@@ -1,8 +1,15 @@
 #pragma once
+#include "../../math.h"
 #include "../render.h"
 
+// NOTE: A glyph is an 8 bit coverage mask, bottom-up like every other bitmap,
+// so the text color is picked when drawing instead of being baked in. Glyphs
+// that weren't loaded have a width and height of 0.
 typedef struct Glyph {
-  LoadedBitmap* bitmap;
+  u8* coverage;
+  int width;
+  int height;
+  int pitch;
   int ascent;
 } Glyph;
 
@@ -10,8 +17,45 @@ typedef struct Font {
   Glyph glyphs[128];
   int advance_width;
   int line_gap;
+  // Every glyph's coverage lives in this one allocation.
+  u8* coverage_memory;
 } Font;
 
-void draw_string(LoadedBitmap* buffer, Font* font, u32 x, u32 y, char* string);
+// A glyph placed at the pixel position of its bottom left corner.
+typedef struct PlacedGlyph {
+  Glyph* glyph;
+  int x;
+  int y;
+} PlacedGlyph;
+
+// Where layout continues from, so a string can be laid out in several runs.
+typedef struct TextCursor {
+  const char* at;
+  int line_x;
+  int x;
+  int y;
+} TextCursor;
+
+// Starts a cursor at string with the first baseline at x, y.
+TextCursor text_cursor(const char* string, int x, int y);
+
+// Lays out glyphs from the cursor until the string ends or max_count visible
+// glyphs have been written to placed, and returns how many were written.
+u32 layout_text(Font* font, TextCursor* cursor, PlacedGlyph* placed,
+                u32 max_count);
+
+// Blends a laid out run of glyphs into the buffer in color, which is not
+// premultiplied. Glyphs are clipped to the buffer.
+void draw_glyph_run(LoadedBitmap* buffer, PlacedGlyph* placed, u32 count,
+                    V4 color);
+
+void draw_text(LoadedBitmap* buffer, Font* font, int x, int y,
+               const char* string, V4 color);
+
+// Draws in white.
+void draw_string(LoadedBitmap* buffer, Font* font, u32 x, u32 y,
+                 const char* string);
 
 Font win32_load_font(char* font_name);
+
+void free_font(Font* font);
@@ -1,5 +1,9 @@
 #pragma once
 
 #include "./render.h"
+#include "./present.h"
 #include "./gui/gui.h"
 #include "./font/font.h"
+#include "./particles/particles.h"
+#include "./anim/anim.h"
+#include "./light/light.h"
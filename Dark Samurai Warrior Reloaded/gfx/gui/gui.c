@@ -34,7 +34,7 @@ static int textHeight(const Font font, const char* text) {
   for (size_t i = 0; i < length; ++i) {
     char currentCharacter = text[i];
     currentTallestCharacter = MAX(currentTallestCharacter,
-                                  font.glyphs[currentCharacter].bitmap->height);
+                                  font.glyphs[currentCharacter].height);
   }
   return currentTallestCharacter;
 }
@@ -0,0 +1,359 @@
+#include "./light.h"
+
+#include <stdbool.h>
+
+#include "../../jobs/jobs.h"
+#include "../../memory/memory.h"
+
+#define LIGHT_ROWS_PER_JOB 4
+#define COMPOSITE_ROWS_PER_JOB 16
+
+static int round_up_to_lanes(int count) {
+  return (count + LANE_WIDTH - 1) & ~(LANE_WIDTH - 1);
+}
+
+// Where a buffer pixel's center falls between two lightmap texel centers.
+static void lightmap_sample(int pixel, int texel_count, s32 *texel,
+                            float *weight) {
+  float position = (pixel + 0.5f) / LIGHTMAP_SCALE - 0.5f;
+  if (position <= 0.0f) {
+    *texel = 0;
+    *weight = 0.0f;
+  } else if (position >= texel_count - 1) {
+    // NOTE: The next texel is read but weighted by 0, so it only has to be
+    // inside the row.
+    *texel = texel_count - 1;
+    *weight = 0.0f;
+  } else {
+    *texel = (s32)position;
+    *weight = position - *texel;
+  }
+}
+
+void init_lighting(Lighting *lighting, int target_width, int target_height) {
+  int width = (target_width + LIGHTMAP_SCALE - 1) / LIGHTMAP_SCALE;
+  int height = (target_height + LIGHTMAP_SCALE - 1) / LIGHTMAP_SCALE;
+  // One spare column so the texel right of the last one can always be read.
+  int pitch = round_up_to_lanes(width + 1);
+  int expanded_pitch = round_up_to_lanes(target_width);
+
+  size_t lightmap_floats = 3 * (size_t)pitch * height;
+  size_t expanded_floats = 3 * (size_t)expanded_pitch * height;
+  size_t size = (lightmap_floats + expanded_floats) * sizeof(float) +
+                target_width * (sizeof(s32) + sizeof(float));
+  // NOTE: Page allocations are zeroed and aligned, and every pitch is a
+  // multiple of LANE_WIDTH, so each row can be loaded a lane at a time.
+  float *memory = (float *)mem_virtual_alloc(MEMORY_TAG_RENDER, size);
+  assert(memory);
+
+  *lighting = (Lighting){
+      .width = width,
+      .height = height,
+      .pitch = pitch,
+      .target_width = target_width,
+      .target_height = target_height,
+      .r = memory,
+      .g = memory + pitch * height,
+      .b = memory + 2 * pitch * height,
+      .expanded_pitch = expanded_pitch,
+      .expanded_r = memory + lightmap_floats,
+      .expanded_g = memory + lightmap_floats + expanded_pitch * height,
+      .expanded_b = memory + lightmap_floats + 2 * expanded_pitch * height,
+      .memory = memory,
+  };
+  lighting->column = (s32 *)(memory + lightmap_floats + expanded_floats);
+  lighting->column_weight = (float *)(lighting->column + target_width);
+  for (int x = 0; x < target_width; x++) {
+    lightmap_sample(x, width, &lighting->column[x],
+                    &lighting->column_weight[x]);
+  }
+}
+
+void free_lighting(Lighting *lighting) {
+  mem_virtual_free(lighting->memory);
+  lighting->memory = 0;
+}
+
+void begin_lighting(Lighting *lighting, V3 ambient) {
+  lighting->ambient = ambient;
+  lighting->light_count = 0;
+  lighting->occluder_count = 0;
+}
+
+static void add_light(Lighting *lighting, Light light) {
+  if (lighting->light_count == MAX_LIGHTS) return;
+  // NOTE: Nudged off the pixel grid so shadow rays are never exactly parallel
+  // to an occluder edge that starts at the light, which divides 0 by 0.
+  light.pos = v2_add(light.pos, v2(0.01f, 0.01f));
+  lighting->lights[lighting->light_count++] = light;
+}
+
+void add_point_light(Lighting *lighting, V2 pos, float radius, V3 color) {
+  add_light(lighting, (Light){.pos = pos,
+                              .color = color,
+                              .radius = radius,
+                              .inner_cosine = -1.0f,
+                              .outer_cosine = -2.0f});
+}
+
+void add_spot_light(Lighting *lighting, V2 pos, float radius, V3 color,
+                    V2 direction, float cone_cosine) {
+  // The outer fifth of the cone fades out.
+  add_light(lighting,
+            (Light){.pos = pos,
+                    .color = color,
+                    .radius = radius,
+                    .direction = v2_normalize(direction),
+                    .inner_cosine = cone_cosine + (1.0f - cone_cosine) * 0.2f,
+                    .outer_cosine = cone_cosine});
+}
+
+void add_light_occluder(Lighting *lighting, int x, int y, int width,
+                        int height) {
+  LightOccluder added = {
+      .min = v2((float)x, (float)y),
+      .max = v2((float)(x + width), (float)(y + height)),
+  };
+  // NOTE: Walls come in one tile at a time. A rectangle that lines up with
+  // one we already have and touches it grows that one instead, so a wall
+  // costs one occluder rather than one per tile, and shadows are the same.
+  for (u32 i = 0; i < lighting->occluder_count; i++) {
+    LightOccluder *occluder = &lighting->occluders[i];
+    if (occluder->min.x == added.min.x && occluder->max.x == added.max.x &&
+        (occluder->max.y == added.min.y || occluder->min.y == added.max.y)) {
+      occluder->min.y = MIN(occluder->min.y, added.min.y);
+      occluder->max.y = MAX(occluder->max.y, added.max.y);
+      return;
+    }
+    if (occluder->min.y == added.min.y && occluder->max.y == added.max.y &&
+        (occluder->max.x == added.min.x || occluder->min.x == added.max.x)) {
+      occluder->min.x = MIN(occluder->min.x, added.min.x);
+      occluder->max.x = MAX(occluder->max.x, added.max.x);
+      return;
+    }
+  }
+  // Dropping one would make its shadow vanish, so running out is a bug.
+  assert(lighting->occluder_count < MAX_LIGHT_OCCLUDERS);
+  lighting->occluders[lighting->occluder_count++] = added;
+}
+
+// Clears for lanes whose ray from the light to (x, y) passes through the
+// occluder, using the slab test.
+static LaneF32 unshadowed(Light *light, LightOccluder *occluder, LaneF32 x,
+                          LaneF32 y) {
+  LaneF32 one = lane_f32(1.0f);
+  V2 min = v2_sub(occluder->min, light->pos);
+  V2 max = v2_sub(occluder->max, light->pos);
+  LaneF32 inverse_x =
+      lane_f32_div(one, lane_f32_sub(x, lane_f32(light->pos.x)));
+  LaneF32 inverse_y =
+      lane_f32_div(one, lane_f32_sub(y, lane_f32(light->pos.y)));
+  LaneF32 x0 = lane_f32_mul(lane_f32(min.x), inverse_x);
+  LaneF32 x1 = lane_f32_mul(lane_f32(max.x), inverse_x);
+  LaneF32 y0 = lane_f32_mul(lane_f32(min.y), inverse_y);
+  LaneF32 y1 = lane_f32_mul(lane_f32(max.y), inverse_y);
+  // Where the ray enters and leaves the rectangle, as a fraction of the way
+  // from the light to the texel.
+  LaneF32 enter = lane_f32_max(lane_f32_min(x0, x1), lane_f32_min(y0, y1));
+  LaneF32 exit = lane_f32_min(lane_f32_max(x0, x1), lane_f32_max(y0, y1));
+  LaneF32 hit = lane_mask_and(
+      lane_f32_less_equal(lane_f32_max(enter, lane_f32(0.0f)), exit),
+      lane_f32_less_equal(enter, one));
+  return lane_f32_select(hit, lane_f32(0.0f), one);
+}
+
+static bool occluder_contains(LightOccluder *occluder, V2 pos) {
+  return pos.x >= occluder->min.x && pos.x <= occluder->max.x &&
+         pos.y >= occluder->min.y && pos.y <= occluder->max.y;
+}
+
+// Whether the occluder overlaps the square the light reaches.
+static bool occluder_in_range(LightOccluder *occluder, Light *light) {
+  return occluder->max.x >= light->pos.x - light->radius &&
+         occluder->min.x <= light->pos.x + light->radius &&
+         occluder->max.y >= light->pos.y - light->radius &&
+         occluder->min.y <= light->pos.y + light->radius;
+}
+
+static void accumulate_light(Lighting *lighting, Light *light, int row) {
+  float texel_size = (float)LIGHTMAP_SCALE;
+  float center_y = (row + 0.5f) * texel_size;
+  float dy = center_y - light->pos.y;
+  if (dy * dy >= light->radius * light->radius) return;
+
+  // Only the lanes that cover the light's extent on this row.
+  int min_x = (int)((light->pos.x - light->radius) / texel_size);
+  int max_x = (int)((light->pos.x + light->radius) / texel_size) + 1;
+  min_x = MAX(min_x, 0) & ~(LANE_WIDTH - 1);
+  max_x = MIN(max_x, lighting->width);
+  if (min_x >= max_x) return;
+
+  LightOccluder *occluders[MAX_LIGHT_OCCLUDERS];
+  u32 occluder_count = 0;
+  for (u32 i = 0; i < lighting->occluder_count; i++) {
+    LightOccluder *occluder = &lighting->occluders[i];
+    // NOTE: A light inside an occluder would be shadowed everywhere, so it
+    // shines through that one.
+    if (occluder_in_range(occluder, light) &&
+        !occluder_contains(occluder, light->pos)) {
+      occluders[occluder_count++] = occluder;
+    }
+  }
+
+  static const u32 lane_index[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  LaneF32 lane_offset = lane_f32_mul(
+      lane_f32_from_u32(lane_u32_loadu(lane_index)), lane_f32(texel_size));
+  LaneF32 zero = lane_f32(0.0f);
+  LaneF32 y = lane_f32(center_y);
+  LaneF32 dy_lane = lane_f32(dy);
+  LaneF32 dy_squared = lane_f32(dy * dy);
+  LaneF32 inverse_radius_squared =
+      lane_f32(1.0f / (light->radius * light->radius));
+  bool spot = light->outer_cosine >= -1.0f;
+  LaneF32 direction_x = lane_f32(light->direction.x);
+  LaneF32 direction_y = lane_f32(light->direction.y);
+  LaneF32 outer_cosine = lane_f32(light->outer_cosine);
+  LaneF32 inverse_cone = lane_f32(
+      1.0f / MAX(light->inner_cosine - light->outer_cosine, 0.0001f));
+
+  float *r = lighting->r + row * lighting->pitch;
+  float *g = lighting->g + row * lighting->pitch;
+  float *b = lighting->b + row * lighting->pitch;
+  for (int texel = min_x; texel < max_x; texel += LANE_WIDTH) {
+    LaneF32 x = lane_f32_add(lane_f32((texel + 0.5f) * texel_size),
+                             lane_offset);
+    LaneF32 dx = lane_f32_sub(x, lane_f32(light->pos.x));
+    LaneF32 distance_squared =
+        lane_f32_add(lane_f32_mul(dx, dx), dy_squared);
+    // (1 - d^2 / r^2)^2 falls off smoothly to 0 at the radius.
+    LaneF32 falloff = lane_f32_clamp01(lane_f32_sub(
+        lane_f32(1.0f),
+        lane_f32_mul(distance_squared, inverse_radius_squared)));
+    LaneF32 intensity = lane_f32_mul(falloff, falloff);
+    if (spot) {
+      LaneF32 cosine = lane_f32_div(
+          lane_f32_add(lane_f32_mul(dx, direction_x),
+                       lane_f32_mul(dy_lane, direction_y)),
+          lane_f32_sqrt(lane_f32_add(distance_squared, lane_f32(0.0001f))));
+      intensity = lane_f32_mul(
+          intensity, lane_f32_clamp01(lane_f32_mul(
+                         lane_f32_sub(cosine, outer_cosine), inverse_cone)));
+    }
+    if (!lane_mask_bits(lane_f32_greater(intensity, zero))) continue;
+
+    for (u32 i = 0; i < occluder_count; i++) {
+      intensity =
+          lane_f32_mul(intensity, unshadowed(light, occluders[i], x, y));
+    }
+
+    lane_f32_store(r + texel,
+                   lane_f32_add(lane_f32_load(r + texel),
+                                lane_f32_mul(intensity,
+                                             lane_f32(light->color.r))));
+    lane_f32_store(g + texel,
+                   lane_f32_add(lane_f32_load(g + texel),
+                                lane_f32_mul(intensity,
+                                             lane_f32(light->color.g))));
+    lane_f32_store(b + texel,
+                   lane_f32_add(lane_f32_load(b + texel),
+                                lane_f32_mul(intensity,
+                                             lane_f32(light->color.b))));
+  }
+}
+
+// Fills lightmap rows with ambient, adds every light, then stretches the rows
+// to the buffer's width.
+static void light_rows(void *data, u32 begin, u32 end) {
+  Lighting *lighting = (Lighting *)data;
+  LaneF32 ambient_r = lane_f32(lighting->ambient.r);
+  LaneF32 ambient_g = lane_f32(lighting->ambient.g);
+  LaneF32 ambient_b = lane_f32(lighting->ambient.b);
+  for (u32 row = begin; row < end; row++) {
+    float *r = lighting->r + row * lighting->pitch;
+    float *g = lighting->g + row * lighting->pitch;
+    float *b = lighting->b + row * lighting->pitch;
+    for (int x = 0; x < lighting->pitch; x += LANE_WIDTH) {
+      lane_f32_store(r + x, ambient_r);
+      lane_f32_store(g + x, ambient_g);
+      lane_f32_store(b + x, ambient_b);
+    }
+
+    for (u32 i = 0; i < lighting->light_count; i++) {
+      accumulate_light(lighting, &lighting->lights[i], row);
+    }
+
+    float *expanded_r = lighting->expanded_r + row * lighting->expanded_pitch;
+    float *expanded_g = lighting->expanded_g + row * lighting->expanded_pitch;
+    float *expanded_b = lighting->expanded_b + row * lighting->expanded_pitch;
+    for (int x = 0; x < lighting->target_width; x++) {
+      s32 texel = lighting->column[x];
+      float t = lighting->column_weight[x];
+      expanded_r[x] = r[texel] + (r[texel + 1] - r[texel]) * t;
+      expanded_g[x] = g[texel] + (g[texel + 1] - g[texel]) * t;
+      expanded_b[x] = b[texel] + (b[texel + 1] - b[texel]) * t;
+    }
+  }
+}
+
+typedef struct CompositeJob {
+  LoadedBitmap *buffer;
+  Lighting *lighting;
+} CompositeJob;
+
+// Multiplies buffer rows by the lightmap, blending between the two stretched
+// lightmap rows around each one.
+static void composite_rows(void *data, u32 begin, u32 end) {
+  CompositeJob *job = (CompositeJob *)data;
+  Lighting *lighting = job->lighting;
+  LaneF32 max_channel = lane_f32(255.0f);
+  for (u32 y = begin; y < end; y++) {
+    s32 row;
+    float t;
+    lightmap_sample(y, lighting->height, &row, &t);
+    int next_row = MIN(row + 1, lighting->height - 1);
+    int pitch = lighting->expanded_pitch;
+    float *r0 = lighting->expanded_r + row * pitch;
+    float *g0 = lighting->expanded_g + row * pitch;
+    float *b0 = lighting->expanded_b + row * pitch;
+    float *r1 = lighting->expanded_r + next_row * pitch;
+    float *g1 = lighting->expanded_g + next_row * pitch;
+    float *b1 = lighting->expanded_b + next_row * pitch;
+    LaneF32 t_lane = lane_f32(t);
+
+    u32 *pixels = (u32 *)((char *)job->buffer->memory + y * job->buffer->pitch);
+    int x = 0;
+    for (; x + LANE_WIDTH <= lighting->target_width; x += LANE_WIDTH) {
+      LaneF32 light_r =
+          lane_f32_lerp(lane_f32_load(r0 + x), t_lane, lane_f32_load(r1 + x));
+      LaneF32 light_g =
+          lane_f32_lerp(lane_f32_load(g0 + x), t_lane, lane_f32_load(g1 + x));
+      LaneF32 light_b =
+          lane_f32_lerp(lane_f32_load(b0 + x), t_lane, lane_f32_load(b1 + x));
+      LaneU32 pixel = lane_u32_loadu(pixels + x);
+      LaneF32 r = lane_f32_min(
+          lane_f32_mul(lane_unpack_channel(pixel, 16), light_r), max_channel);
+      LaneF32 g = lane_f32_min(
+          lane_f32_mul(lane_unpack_channel(pixel, 8), light_g), max_channel);
+      LaneF32 b = lane_f32_min(
+          lane_f32_mul(lane_unpack_channel(pixel, 0), light_b), max_channel);
+      lane_u32_storeu(pixels + x,
+                      lane_pack_color(r, g, b, lane_unpack_channel(pixel, 24)));
+    }
+    for (; x < lighting->target_width; x++) {
+      V4 color = v4_color_from_u32(pixels[x]);
+      color.r *= r0[x] + (r1[x] - r0[x]) * t;
+      color.g *= g0[x] + (g1[x] - g0[x]) * t;
+      color.b *= b0[x] + (b1[x] - b0[x]) * t;
+      pixels[x] = u32_color_from_v4(color);
+    }
+  }
+}
+
+void apply_lighting(LoadedBitmap *buffer, Lighting *lighting) {
+  assert(buffer->width == lighting->target_width &&
+         buffer->height == lighting->target_height);
+  job_parallel_for(lighting->height, LIGHT_ROWS_PER_JOB, light_rows, lighting);
+  CompositeJob job = {.buffer = buffer, .lighting = lighting};
+  job_parallel_for(buffer->height, COMPOSITE_ROWS_PER_JOB, composite_rows,
+                   &job);
+}
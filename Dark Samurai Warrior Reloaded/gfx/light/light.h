@@ -0,0 +1,83 @@
+#pragma once
+#include "../../common.h"
+#include "../../math.h"
+#include "../render.h"
+
+// Lights are accumulated into a lightmap LIGHTMAP_SCALE times smaller than the
+// buffer on each axis, then stretched back up and multiplied into it.
+#define LIGHTMAP_SCALE 4
+#define MAX_LIGHTS 64
+#define MAX_LIGHT_OCCLUDERS 32
+
+// NOTE: Point lights are spot lights whose cone is the whole circle.
+typedef struct Light {
+  V2 pos;
+  // 1 is full brightness, lights can go over it to brighten.
+  V3 color;
+  float radius;
+  // Spot lights are full strength inside inner_cosine of direction and fade
+  // out to nothing at outer_cosine.
+  V2 direction;
+  float inner_cosine;
+  float outer_cosine;
+} Light;
+
+// A rectangle in buffer pixels that blocks light.
+typedef struct LightOccluder {
+  V2 min;
+  V2 max;
+} LightOccluder;
+
+typedef struct Lighting {
+  // Lightmap size, and its pitch in floats.
+  int width;
+  int height;
+  int pitch;
+  // Size of the buffer it is applied to.
+  int target_width;
+  int target_height;
+  float* r;
+  float* g;
+  float* b;
+  // The lightmap stretched to the buffer's width, but not its height yet.
+  int expanded_pitch;
+  float* expanded_r;
+  float* expanded_g;
+  float* expanded_b;
+  // For every buffer column, the lightmap column to its left and how far it
+  // is towards the next one.
+  s32* column;
+  float* column_weight;
+
+  V3 ambient;
+  Light lights[MAX_LIGHTS];
+  u32 light_count;
+  LightOccluder occluders[MAX_LIGHT_OCCLUDERS];
+  u32 occluder_count;
+  void* memory;
+} Lighting;
+
+void init_lighting(Lighting* lighting, int target_width, int target_height);
+
+void free_lighting(Lighting* lighting);
+
+// Clears the lights and occluders for a new frame. Everything gets at least
+// ambient.
+void begin_lighting(Lighting* lighting, V3 ambient);
+
+void add_point_light(Lighting* lighting, V2 pos, float radius, V3 color);
+
+// cone_cosine is the cosine of the cone's half angle, like m3x3_rotation
+// takes the sine and cosine, so there's no trig in here.
+void add_spot_light(Lighting* lighting, V2 pos, float radius, V3 color,
+                    V2 direction, float cone_cosine);
+
+// Touching rectangles with the same extent are merged, so a wall added tile
+// by tile takes one occluder. Asserts when there are more than
+// MAX_LIGHT_OCCLUDERS after merging.
+void add_light_occluder(Lighting* lighting, int x, int y, int width,
+                        int height);
+
+// Builds the lightmap from this frame's lights and multiplies it into the
+// buffer, which has to be the size lighting was initialized with.
+void apply_lighting(LoadedBitmap* buffer, Lighting* lighting);
@@ -0,0 +1,235 @@
+#include "./particles.h"
+
+#include <stdbool.h>
+
+#include "../../jobs/jobs.h"
+#include "../../memory/memory.h"
+
+// x, y, velocity_x, velocity_y, life, inverse_lifetime, r, g, b, a
+#define PARTICLE_ARRAY_COUNT 10
+#define PARTICLE_BAND_HEIGHT 64
+
+void init_particles(ParticleSystem *particles, u32 capacity, int size,
+                    V2 gravity) {
+  capacity = (capacity + LANE_WIDTH - 1) & ~(LANE_WIDTH - 1);
+  float *memory = (float *)mem_virtual_alloc(
+      MEMORY_TAG_RENDER, PARTICLE_ARRAY_COUNT * capacity * sizeof(float));
+  assert(memory);
+
+  float **arrays[PARTICLE_ARRAY_COUNT] = {
+      &particles->x,    &particles->y,
+      &particles->velocity_x, &particles->velocity_y,
+      &particles->life, &particles->inverse_lifetime,
+      &particles->r,    &particles->g,
+      &particles->b,    &particles->a,
+  };
+  // NOTE: capacity is a multiple of LANE_WIDTH, so every array stays aligned
+  // for lane loads.
+  for (int i = 0; i < PARTICLE_ARRAY_COUNT; i++) {
+    *arrays[i] = memory + i * capacity;
+  }
+  particles->memory = memory;
+  particles->count = 0;
+  particles->capacity = capacity;
+  particles->size = size;
+  particles->gravity = gravity;
+  particles->random_state = 0x2545F491;
+}
+
+void free_particles(ParticleSystem *particles) {
+  mem_virtual_free(particles->memory);
+  particles->memory = 0;
+  particles->count = 0;
+  particles->capacity = 0;
+}
+
+static u32 next_random(ParticleSystem *particles) {
+  // xorshift32
+  u32 x = particles->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  particles->random_state = x;
+  return x;
+}
+
+// Returns a random float in [0, 1).
+static float random_unilateral(ParticleSystem *particles) {
+  return (float)(next_random(particles) >> 8) / (float)(1 << 24);
+}
+
+// Returns a random float in [-1, 1).
+static float random_bilateral(ParticleSystem *particles) {
+  return 2.0f * random_unilateral(particles) - 1.0f;
+}
+
+void burst_particles(ParticleSystem *particles, ParticleEmitter *emitter,
+                     u32 count) {
+  count = MIN(count, particles->capacity - particles->count);
+  for (u32 n = 0; n < count; n++) {
+    u32 i = particles->count++;
+    particles->x[i] =
+        emitter->pos.x + random_unilateral(particles) * emitter->extent.x;
+    particles->y[i] =
+        emitter->pos.y + random_unilateral(particles) * emitter->extent.y;
+    particles->velocity_x[i] =
+        emitter->velocity.x + random_bilateral(particles) * emitter->spread.x;
+    particles->velocity_y[i] =
+        emitter->velocity.y + random_bilateral(particles) * emitter->spread.y;
+    particles->life[i] = emitter->lifetime;
+    particles->inverse_lifetime[i] = 1.0f / emitter->lifetime;
+    particles->r[i] = emitter->color.r;
+    particles->g[i] = emitter->color.g;
+    particles->b[i] = emitter->color.b;
+    particles->a[i] = emitter->color.a;
+  }
+}
+
+void emit_particles(ParticleSystem *particles, ParticleEmitter *emitter,
+                    float dt) {
+  emitter->accumulator += emitter->rate * dt;
+  u32 count = (u32)emitter->accumulator;
+  emitter->accumulator -= count;
+  burst_particles(particles, emitter, count);
+}
+
+static void move_particle(ParticleSystem *particles, u32 from, u32 to) {
+  particles->x[to] = particles->x[from];
+  particles->y[to] = particles->y[from];
+  particles->velocity_x[to] = particles->velocity_x[from];
+  particles->velocity_y[to] = particles->velocity_y[from];
+  particles->life[to] = particles->life[from];
+  particles->inverse_lifetime[to] = particles->inverse_lifetime[from];
+  particles->r[to] = particles->r[from];
+  particles->g[to] = particles->g[from];
+  particles->b[to] = particles->b[from];
+  particles->a[to] = particles->a[from];
+}
+
+void update_particles(ParticleSystem *particles, float dt) {
+  LaneF32 dt_lane = lane_f32(dt);
+  LaneF32 gravity_x = lane_f32(particles->gravity.x * dt);
+  LaneF32 gravity_y = lane_f32(particles->gravity.y * dt);
+  for (u32 i = 0; i < particles->count; i += LANE_WIDTH) {
+    LaneF32 velocity_x =
+        lane_f32_add(lane_f32_load(particles->velocity_x + i), gravity_x);
+    LaneF32 velocity_y =
+        lane_f32_add(lane_f32_load(particles->velocity_y + i), gravity_y);
+    LaneF32 x = lane_f32_add(lane_f32_load(particles->x + i),
+                             lane_f32_mul(velocity_x, dt_lane));
+    LaneF32 y = lane_f32_add(lane_f32_load(particles->y + i),
+                             lane_f32_mul(velocity_y, dt_lane));
+    LaneF32 life = lane_f32_sub(lane_f32_load(particles->life + i), dt_lane);
+
+    lane_f32_store(particles->velocity_x + i, velocity_x);
+    lane_f32_store(particles->velocity_y + i, velocity_y);
+    lane_f32_store(particles->x + i, x);
+    lane_f32_store(particles->y + i, y);
+    lane_f32_store(particles->life + i, life);
+  }
+
+  // Swap the last particle into the place of every dead one, skipping whole
+  // lanes of particles that are all still alive.
+  LaneF32 zero = lane_f32(0.0f);
+  u32 i = 0;
+  while (i < particles->count) {
+    bool whole_lane =
+        (i % LANE_WIDTH) == 0 && i + LANE_WIDTH <= particles->count;
+    if (whole_lane && !lane_mask_bits(lane_f32_less_equal(
+                          lane_f32_load(particles->life + i), zero))) {
+      i += LANE_WIDTH;
+    } else if (particles->life[i] <= 0.0f) {
+      move_particle(particles, --particles->count, i);
+    } else {
+      i++;
+    }
+  }
+}
+
+static void draw_particles_clipped(LoadedBitmap *buffer,
+                                   ParticleSystem *particles, int min_x,
+                                   int min_y, int max_x, int max_y) {
+  int size = particles->size;
+  LaneF32 zero = lane_f32(0.0f);
+  LaneF32 c255 = lane_f32(255.0f);
+  LaneF32 clip_min_x = lane_f32((float)(min_x - size));
+  LaneF32 clip_min_y = lane_f32((float)(min_y - size));
+  LaneF32 clip_max_x = lane_f32((float)max_x);
+  LaneF32 clip_max_y = lane_f32((float)max_y);
+
+  for (u32 i = 0; i < particles->count; i += LANE_WIDTH) {
+    LaneF32 x = lane_f32_load(particles->x + i);
+    LaneF32 y = lane_f32_load(particles->y + i);
+    LaneF32 life = lane_f32_load(particles->life + i);
+
+    // Reject particles whose square doesn't touch the clip rect.
+    LaneF32 visible = lane_mask_and(lane_f32_greater(x, clip_min_x),
+                                    lane_f32_less(x, clip_max_x));
+    visible = lane_mask_and(visible, lane_f32_greater(y, clip_min_y));
+    visible = lane_mask_and(visible, lane_f32_less(y, clip_max_y));
+    visible = lane_mask_and(visible, lane_f32_greater(life, zero));
+    int mask = lane_mask_bits(visible);
+    if (i + LANE_WIDTH > particles->count) {
+      mask &= (1 << (particles->count - i)) - 1;
+    }
+    if (!mask) continue;
+
+    // Fade out over the particle's lifetime and premultiply.
+    LaneF32 alpha =
+        lane_f32_mul(lane_f32_mul(lane_f32_load(particles->a + i), life),
+                     lane_f32_load(particles->inverse_lifetime + i));
+    alpha = lane_f32_mul(lane_f32_clamp01(alpha), c255);
+    LaneU32 color = lane_pack_color(
+        lane_f32_mul(lane_f32_load(particles->r + i), alpha),
+        lane_f32_mul(lane_f32_load(particles->g + i), alpha),
+        lane_f32_mul(lane_f32_load(particles->b + i), alpha), alpha);
+
+    u32 colors[LANE_WIDTH];
+    u32 xs[LANE_WIDTH];
+    u32 ys[LANE_WIDTH];
+    lane_u32_storeu(colors, color);
+    lane_u32_storeu(xs, lane_u32_from_f32(x));
+    lane_u32_storeu(ys, lane_u32_from_f32(y));
+
+    for (int lane = 0; lane < LANE_WIDTH; lane++) {
+      if (!(mask & (1 << lane))) continue;
+      int start_x = MAX((s32)xs[lane], min_x);
+      int end_x = MIN((s32)xs[lane] + size, max_x);
+      int start_y = MAX((s32)ys[lane], min_y);
+      int end_y = MIN((s32)ys[lane] + size, max_y);
+      char *row = (char *)buffer->memory + start_x * BYTES_PER_PIXEL +
+                  start_y * buffer->pitch;
+      for (int py = start_y; py < end_y; py++) {
+        u32 *pixel = (u32 *)row;
+        for (int px = start_x; px < end_x; px++) {
+          *pixel = blend_premultiplied(*pixel, colors[lane]);
+          pixel++;
+        }
+        row += buffer->pitch;
+      }
+    }
+  }
+}
+
+typedef struct DrawParticlesJob {
+  LoadedBitmap *buffer;
+  ParticleSystem *particles;
+} DrawParticlesJob;
+
+static void draw_particle_bands(void *data, u32 begin, u32 end) {
+  DrawParticlesJob *job = (DrawParticlesJob *)data;
+  for (u32 band = begin; band < end; band++) {
+    int min_y = band * PARTICLE_BAND_HEIGHT;
+    int max_y = MIN(min_y + PARTICLE_BAND_HEIGHT, job->buffer->height);
+    draw_particles_clipped(job->buffer, job->particles, 0, min_y,
+                           job->buffer->width, max_y);
+  }
+}
+
+void draw_particles(LoadedBitmap *buffer, ParticleSystem *particles) {
+  if (!particles->count) return;
+  DrawParticlesJob job = {.buffer = buffer, .particles = particles};
+  u32 band_count =
+      (buffer->height + PARTICLE_BAND_HEIGHT - 1) / PARTICLE_BAND_HEIGHT;
+  job_parallel_for(band_count, 1, draw_particle_bands, &job);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "../../common.h"
+#include "../../math.h"
+#include "../render.h"
+
+// NOTE: Particles are stored struct-of-arrays and updated LANE_WIDTH at a
+// time, so the capacity is always rounded up to a multiple of LANE_WIDTH and
+// lanes past count are scratch space.
+typedef struct ParticleSystem {
+  u32 count;
+  u32 capacity;
+  float* x;
+  float* y;
+  float* velocity_x;
+  float* velocity_y;
+  // Seconds left to live, and 1 / total lifetime so alpha can fade out.
+  float* life;
+  float* inverse_lifetime;
+  float* r;
+  float* g;
+  float* b;
+  float* a;
+  V2 gravity;
+  // Particles are drawn as size x size squares.
+  int size;
+  u32 random_state;
+  void* memory;
+} ParticleSystem;
+
+typedef struct ParticleEmitter {
+  // Particles spawn anywhere in the rectangle pos + [0, extent].
+  V2 pos;
+  V2 extent;
+  V2 velocity;
+  // Random velocity added on top, in [-spread, spread] on each axis.
+  V2 spread;
+  float lifetime;
+  // Particles per second for emit_particles.
+  float rate;
+  float accumulator;
+  // Not premultiplied.
+  V4 color;
+} ParticleEmitter;
+
+void init_particles(ParticleSystem* particles, u32 capacity, int size,
+                    V2 gravity);
+
+void free_particles(ParticleSystem* particles);
+
+// Spawns particles at the emitter's rate for dt seconds.
+void emit_particles(ParticleSystem* particles, ParticleEmitter* emitter,
+                    float dt);
+
+// Spawns count particles at once, for one off effects like sword hits.
+void burst_particles(ParticleSystem* particles, ParticleEmitter* emitter,
+                     u32 count);
+
+void update_particles(ParticleSystem* particles, float dt);
+
+// Blends every particle into the buffer. The buffer is split into bands of
+// rows that are drawn in parallel, each clipped to its own band.
+void draw_particles(LoadedBitmap* buffer, ParticleSystem* particles);
@@ -0,0 +1,79 @@
+#include "./present.h"
+
+#include "../atomics.h"
+
+#define PRESENT_NEW_FRAME 0x4
+#define PRESENT_INDEX_MASK 0x3
+
+static DWORD WINAPI present_thread_proc(LPVOID parameter) {
+  Win32Presenter *presenter = (Win32Presenter *)parameter;
+  // NOTE: The window class is CS_OWNDC, so this DC stays valid for the life of
+  // the window and we don't pay for GetDC/ReleaseDC every frame.
+  HDC dc = GetDC(presenter->window);
+  while (true) {
+    WaitForSingleObject(presenter->frame_ready, INFINITE);
+    if (!atomic_load_s32(&presenter->running)) break;
+
+    if (!(atomic_load_s32(&presenter->middle) & PRESENT_NEW_FRAME)) continue;
+    presenter->front =
+        atomic_exchange_s32(&presenter->middle, presenter->front) &
+        PRESENT_INDEX_MASK;
+
+    Dim dim = win32_get_window_dimensions(presenter->window);
+    win32_display_buffer_in_window(&presenter->buffers[presenter->front], dc,
+                                   dim.width, dim.height);
+  }
+  ReleaseDC(presenter->window, dc);
+  return 0;
+}
+
+void win32_start_presenter(Win32Presenter *presenter, HWND window, int width,
+                           int height) {
+  presenter->window = window;
+  for (int i = 0; i < PRESENT_BUFFER_COUNT; i++) {
+    Win32Buffer *buffer = &presenter->buffers[i];
+    buffer->bitmap = allocate_bitmap(width, height);
+    // NOTE: A DIB's rows are biWidth pixels apart, so it has to be the padded
+    // pitch, not the width. win32_display_buffer_in_window only blits the
+    // visible width.
+    BITMAPINFO info = {.bmiHeader = {
+                           .biSize = sizeof(info.bmiHeader),
+                           .biWidth = buffer->bitmap.pitch / BYTES_PER_PIXEL,
+                           .biHeight = height,
+                           .biPlanes = 1,
+                           .biBitCount = BYTES_PER_PIXEL * 8,
+                           .biCompression = BI_RGB,
+                       }};
+    buffer->info = info;
+  }
+  presenter->back = 0;
+  presenter->middle = 1;
+  presenter->front = 2;
+  presenter->running = 1;
+  presenter->frame_ready = CreateEventA(0, FALSE, FALSE, 0);
+  assert(presenter->frame_ready);
+  presenter->thread = CreateThread(0, 0, present_thread_proc, presenter, 0, 0);
+  assert(presenter->thread);
+}
+
+void win32_stop_presenter(Win32Presenter *presenter) {
+  atomic_store_s32(&presenter->running, 0);
+  SetEvent(presenter->frame_ready);
+  WaitForSingleObject(presenter->thread, INFINITE);
+  CloseHandle(presenter->thread);
+  CloseHandle(presenter->frame_ready);
+  for (int i = 0; i < PRESENT_BUFFER_COUNT; i++) {
+    free_bitmap(&presenter->buffers[i].bitmap);
+  }
+}
+
+LoadedBitmap *win32_back_buffer(Win32Presenter *presenter) {
+  return &presenter->buffers[presenter->back].bitmap;
+}
+
+void win32_present(Win32Presenter *presenter) {
+  presenter->back = atomic_exchange_s32(&presenter->middle,
+                                        presenter->back | PRESENT_NEW_FRAME) &
+                    PRESENT_INDEX_MASK;
+  SetEvent(presenter->frame_ready);
+}
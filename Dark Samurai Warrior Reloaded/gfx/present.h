@@ -0,0 +1,37 @@
+#pragma once
+#include <Windows.h>
+
+#include "./render.h"
+
+#define PRESENT_BUFFER_COUNT 3
+
+// Triple buffered presentation. The game renders into the back buffer while a
+// dedicated thread shows the most recently finished frame, so the blit to the
+// window never sits on the game's critical path.
+typedef struct Win32Presenter {
+  HWND window;
+  Win32Buffer buffers[PRESENT_BUFFER_COUNT];
+  // Only touched by the game thread.
+  s32 back;
+  // Index of the latest finished frame, with PRESENT_NEW_FRAME set until the
+  // present thread picks it up.
+  volatile s32 middle;
+  // Only touched by the present thread.
+  s32 front;
+  volatile s32 running;
+  HANDLE frame_ready;
+  HANDLE thread;
+} Win32Presenter;
+
+void win32_start_presenter(Win32Presenter* presenter, HWND window, int width,
+                           int height);
+
+void win32_stop_presenter(Win32Presenter* presenter);
+
+// The bitmap the game should render the next frame into.
+LoadedBitmap* win32_back_buffer(Win32Presenter* presenter);
+
+// Hands the finished back buffer to the present thread and returns right away.
+// If the present thread hasn't shown the previous frame yet, it is dropped in
+// favor of this one.
+void win32_present(Win32Presenter* presenter);
@@ -1,57 +1,266 @@
 #include "render.h"
 
+#include <stdbool.h>
+#include <tmmintrin.h>
+
 #include "../io/file.h"
+#include "../jobs/jobs.h"
+#include "../memory/memory.h"
 #include "Windows.h"
 
-inline V4 v4_color_from_u32(u32 color) {
-  V4 result = {.r = (float)((color >> 16) & 0xFF) / 255.0f,
-               .g = (float)((color >> 8) & 0xFF) / 255.0f,
-               .b = (float)((color)&0xFF) / 255.0f,
-               .a = (float)((color >> 24) & 0xFF) / 255.0f};
-  return result;
+// NOTE: Below this many pixels a fill is cheaper than handing it out as jobs.
+#define PARALLEL_FILL_MIN_PIXELS (256 * 256)
+#define FILL_ROWS_PER_JOB 32
+#define DECODE_ROWS_PER_JOB 32
+
+void blend_pixels(u32 *dest, u32 *source, int count) {
+  // NOTE: This is a lerp on the source's alpha value, which has already
+  // been premultiplied into the source color:
+  // dest * (1 - source.a) + source
+  int x = 0;
+  for (; x + LANE_WIDTH <= count; x += LANE_WIDTH) {
+    LaneU32 blended = lane_blend_premultiplied(lane_u32_loadu(dest + x),
+                                               lane_u32_loadu(source + x));
+    lane_u32_storeu(dest + x, blended);
+  }
+  for (; x < count; x++) {
+    dest[x] = blend_premultiplied(dest[x], source[x]);
+  }
+}
+
+void draw_bitmap(LoadedBitmap *buffer, LoadedBitmap *bitmap, int pos_x,
+                 int pos_y) {
+  // clip the bitmap to the edges of the buffer.
+  int min_x = MAX(pos_x, 0);
+  int min_y = MAX(pos_y, 0);
+  int max_x = MIN(pos_x + bitmap->width, buffer->width);
+  int max_y = MIN(pos_y + bitmap->height, buffer->height);
+  if (min_x >= max_x || min_y >= max_y) return;
+  int width = max_x - min_x;
+
+  char *source_row = ((char *)bitmap->memory +
+                      ((min_x - pos_x) * BYTES_PER_PIXEL) +
+                      ((min_y - pos_y) * bitmap->pitch));
+  char *dest_row = ((char *)buffer->memory + (min_x * BYTES_PER_PIXEL) +
+                    (min_y * buffer->pitch));
+
+  for (int y = min_y; y < max_y; y++) {
+    blend_pixels((u32 *)dest_row, (u32 *)source_row, width);
+    source_row += bitmap->pitch;
+    dest_row += buffer->pitch;
+  }
 }
 
-inline u32 u32_color_from_v4(V4 color) {
-  V4 color255 = v4_mul(color, 255.0f);
-  u32 result = (((u32)color255.a << 24) | ((u32)color255.r << 16) |
-                ((u32)color255.g << 8) | ((u32)color255.b));
+LoadedBitmap allocate_bitmap(int width, int height) {
+  int pitch = width * BYTES_PER_PIXEL;
+  pitch = (pitch + BITMAP_ALIGNMENT - 1) & ~(BITMAP_ALIGNMENT - 1);
+  // NOTE: Page allocations are zeroed and page aligned, which covers
+  // BITMAP_ALIGNMENT.
+  LoadedBitmap result = {
+      .width = width,
+      .height = height,
+      .pitch = pitch,
+      .memory = mem_virtual_alloc(MEMORY_TAG_RENDER, (size_t)pitch * height),
+  };
+  assert(result.memory);
   return result;
 }
 
-void draw_bitmap(LoadedBitmap *buffer, LoadedBitmap *bitmap, u32 pos_x,
-                 u32 pos_y) {
-  // TODO: clip the bitmap
-  char *source_row = (char *)bitmap->memory;
+void free_bitmap(LoadedBitmap *bitmap) {
+  mem_virtual_free(bitmap->memory);
+  bitmap->memory = 0;
+}
 
-  char *dest_row = ((char *)buffer->memory + (pos_x * BYTES_PER_PIXEL) +
-                    (pos_y * buffer->pitch));
+// Multiplies the color channels of 4 BGRA pixels by their alpha.
+static __m128i premultiply_4x(__m128i pixels) {
+  __m128i zero = _mm_setzero_si128();
+  // NOTE: Keep a multiplier of 255 in each alpha lane so alpha passes through.
+  __m128i alpha_lanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
 
-  for (s32 y = 0; y < bitmap->height; y++) {
-    u32 *source_pixel = (u32 *)source_row;
-    u32 *dest_pixel = (u32 *)dest_row;
-    for (s32 x = 0; x < bitmap->width; x++) {
-      u32 source_color_32 = *source_pixel;
-      u32 dest_color_32 = *dest_pixel;
+  __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+  __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+  __m128i lo_alpha = _mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i hi_alpha = _mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3));
+  lo_alpha = _mm_shufflehi_epi16(lo_alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  hi_alpha = _mm_shufflehi_epi16(hi_alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  lo = _mm_mullo_epi16(lo, _mm_or_si128(lo_alpha, alpha_lanes));
+  hi = _mm_mullo_epi16(hi, _mm_or_si128(hi_alpha, alpha_lanes));
 
-      V4 source_color = v4_color_from_u32(source_color_32);
-      V4 dest_color = v4_color_from_u32(dest_color_32);
+  // NOTE: Exact rounded divide by 255 for x in [0, 255 * 255]:
+  // x / 255 = (x + 128 + ((x + 128) >> 8)) >> 8
+  __m128i half = _mm_set1_epi16(128);
+  lo = _mm_add_epi16(lo, half);
+  hi = _mm_add_epi16(hi, half);
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
 
-      // NOTE: This is a lerp on the source_color's alpha value because the
-      // alpha has already been premultiplied. lerp(a, t, b) = a * (1 - t) + b *
-      // t dest_color * (1 - source_color.a) + (source_color * source_color.a)
-      // <- the source color has already had its alpha premultiplied.
-      V4 result =
-          v4_add(v4_mul(dest_color, (1.0f - source_color.a)), source_color);
+  return _mm_packus_epi16(lo, hi);
+}
 
-      u32 color = u32_color_from_v4(result);
+static u32 premultiply_pixel(u32 color) {
+  u32 alpha = color >> 24;
+  u32 result = color & 0xFF000000;
+  for (int shift = 0; shift < 24; shift += 8) {
+    u32 x = ((color >> shift) & 0xFF) * alpha + 128;
+    result |= (((x + (x >> 8)) >> 8) << shift);
+  }
+  return result;
+}
+
+typedef enum BitmapFormat {
+  BITMAP_FORMAT_24,
+  // 32 bit pixels whose channel masks are all whole bytes.
+  BITMAP_FORMAT_32_BYTES,
+  // 32 bit pixels with arbitrary channel masks.
+  BITMAP_FORMAT_32_MASKS,
+} BitmapFormat;
+
+typedef struct BitmapChannel {
+  u32 mask;
+  u32 shift;
+  u32 max;
+} BitmapChannel;
 
-      *dest_pixel = color;
+typedef struct BitmapDecoder {
+  BitmapFormat format;
+  bool has_alpha;
+  // Indexed in destination order: blue, green, red, alpha.
+  BitmapChannel channels[4];
+  __m128i shuffle;
+  __m128i opaque;
+} BitmapDecoder;
+
+static BitmapChannel bitmap_channel(u32 mask) {
+  BitmapChannel result = {0};
+  if (mask) {
+    result.mask = mask;
+    result.shift = bitscan_forward(mask);
+    result.max = mask >> result.shift;
+  }
+  return result;
+}
 
-      dest_pixel++;
-      source_pixel++;
+static bool channel_is_byte(BitmapChannel channel) {
+  return channel.max == 0xFF && (channel.shift % 8) == 0;
+}
+
+static BitmapDecoder bitmap_decoder(BitmapHeader *header) {
+  BitmapDecoder result = {0};
+  u32 blue_mask = 0x000000FF;
+  u32 green_mask = 0x0000FF00;
+  u32 red_mask = 0x00FF0000;
+  u32 alpha_mask = 0;
+  // NOTE: BI_RGB has no masks, the high byte of a 32 bit pixel is unused.
+  if (header->compression == BI_BITFIELDS) {
+    blue_mask = header->blue_mask;
+    green_mask = header->green_mask;
+    red_mask = header->red_mask;
+    if (header->size >= 56) alpha_mask = header->alpha_mask;
+  }
+  result.channels[0] = bitmap_channel(blue_mask);
+  result.channels[1] = bitmap_channel(green_mask);
+  result.channels[2] = bitmap_channel(red_mask);
+  result.channels[3] = bitmap_channel(alpha_mask);
+  result.has_alpha = alpha_mask != 0;
+  result.opaque = _mm_set1_epi32(result.has_alpha ? 0 : 0xFF000000);
+
+  // Build a byte shuffle that moves every channel to its BGRA position, and
+  // zeroes the alpha byte when there is no alpha so it can be OR'd to 0xFF.
+  u8 shuffle[16];
+  if (header->bits_per_pixel == 24) {
+    result.format = BITMAP_FORMAT_24;
+    for (int pixel = 0; pixel < 4; pixel++) {
+      for (int channel = 0; channel < 3; channel++) {
+        shuffle[pixel * 4 + channel] = (u8)(pixel * 3 + channel);
+      }
+      shuffle[pixel * 4 + 3] = 0x80;
     }
-    source_row += bitmap->pitch;
-    dest_row += buffer->pitch;
+  } else {
+    result.format = BITMAP_FORMAT_32_BYTES;
+    for (int channel = 0; channel < 4; channel++) {
+      BitmapChannel c = result.channels[channel];
+      if (c.mask && !channel_is_byte(c)) result.format = BITMAP_FORMAT_32_MASKS;
+    }
+    for (int pixel = 0; pixel < 4; pixel++) {
+      for (int channel = 0; channel < 4; channel++) {
+        BitmapChannel c = result.channels[channel];
+        shuffle[pixel * 4 + channel] =
+            c.mask ? (u8)(pixel * 4 + c.shift / 8) : 0x80;
+      }
+    }
+  }
+  result.shuffle = _mm_loadu_si128((__m128i *)shuffle);
+  return result;
+}
+
+static u32 decode_masked_pixel(BitmapDecoder *decoder, u32 color) {
+  u32 result = decoder->has_alpha ? 0 : 0xFF000000;
+  for (int channel = 0; channel < 4; channel++) {
+    BitmapChannel c = decoder->channels[channel];
+    if (!c.mask) continue;
+    // Rescale channels that are not 8 bits wide to 0..255.
+    u32 value = (((color & c.mask) >> c.shift) * 255 + c.max / 2) / c.max;
+    result |= value << (channel * 8);
+  }
+  return result;
+}
+
+static void decode_bitmap_row(BitmapDecoder *decoder, u8 *source, u32 *dest,
+                              int width) {
+  int x = 0;
+  switch (decoder->format) {
+    case BITMAP_FORMAT_24: {
+      // NOTE: Each 16 byte load only uses 12 bytes, so stop while there are
+      // still 2 pixels left to keep the load inside the row.
+      for (; x + 6 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128((__m128i *)(source + x * 3));
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, decoder->shuffle),
+                              decoder->opaque);
+        _mm_store_si128((__m128i *)(dest + x), pixels);
+      }
+      for (; x < width; x++) {
+        u8 *pixel = source + x * 3;
+        dest[x] = 0xFF000000 | (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
+      }
+    } break;
+    case BITMAP_FORMAT_32_BYTES: {
+      for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128((__m128i *)(source + x * 4));
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, decoder->shuffle),
+                              decoder->opaque);
+        if (decoder->has_alpha) pixels = premultiply_4x(pixels);
+        _mm_store_si128((__m128i *)(dest + x), pixels);
+      }
+      for (; x < width; x++) {
+        u32 color = decode_masked_pixel(decoder, ((u32 *)source)[x]);
+        dest[x] = decoder->has_alpha ? premultiply_pixel(color) : color;
+      }
+    } break;
+    case BITMAP_FORMAT_32_MASKS: {
+      for (; x < width; x++) {
+        u32 color = decode_masked_pixel(decoder, ((u32 *)source)[x]);
+        dest[x] = decoder->has_alpha ? premultiply_pixel(color) : color;
+      }
+    } break;
+  }
+}
+
+typedef struct DecodeBitmapJob {
+  BitmapDecoder decoder;
+  u8 *source;
+  int source_pitch;
+  bool top_down;
+  LoadedBitmap *dest;
+} DecodeBitmapJob;
+
+static void decode_bitmap_rows(void *data, u32 begin, u32 end) {
+  DecodeBitmapJob *job = (DecodeBitmapJob *)data;
+  int height = job->dest->height;
+  for (int y = begin; y < (int)end; y++) {
+    int source_y = job->top_down ? height - 1 - y : y;
+    decode_bitmap_row(&job->decoder, job->source + source_y * job->source_pitch,
+                      (u32 *)((u8 *)job->dest->memory + y * job->dest->pitch),
+                      job->dest->width);
   }
 }
 
@@ -59,55 +268,35 @@ LoadedBitmap load_bitmap(char *filename) {
   LoadedFile file = win32_load_file(filename);
   assert(file.size > 0);
   BitmapHeader *header = (BitmapHeader *)file.memory;
-  u32 *pixels = (u32 *)((char *)file.memory + header->bitmap_offset);
-  LoadedBitmap result = {.memory = pixels,
-                         .width = header->width,
-                         .height = header->height,
-                         .pitch = header->width * (header->bits_per_pixel / 8)};
-
-  // There are multiple kinds of bitmap compression. We're only going to handle
-  // one kind right now, which is an uncompressed bitmap. For more info:
+  assert(header->file_type == 0x4D42);  // "BM"
+
+  // There are multiple kinds of bitmap compression. We only handle the
+  // uncompressed ones. For more info:
   // https://learn.microsoft.com/en-us/windows/win32/api/wingdi/ns-wingdi-bitmapv4header
-  assert(header->compression == 3);
-
-  u32 red_mask = header->red_mask;
-  u32 green_mask = header->green_mask;
-  u32 blue_mask = header->blue_mask;
-  u32 alpha_mask = ~(red_mask | green_mask | blue_mask);
-
-  u32 red_index = bitscan_forward(red_mask);
-  u32 green_index = bitscan_forward(green_mask);
-  u32 blue_index = bitscan_forward(blue_mask);
-  u32 alpha_index = bitscan_forward(alpha_mask);
-
-  u32 *source = pixels;
-  for (int y = 0; y < result.height; y++) {
-    for (int x = 0; x < result.width; x++) {
-      u32 color = *source;
-
-      float red_value = (color & red_mask) >> red_index;
-      float green_value = (color & green_mask) >> green_index;
-      float blue_value = (color & blue_mask) >> blue_index;
-      float alpha_value = (color & alpha_mask) >> alpha_index;
-
-      red_value /= 255.0f;
-      green_value /= 255.0f;
-      blue_value /= 255.0f;
-      alpha_value /= 255.0f;
-
-      red_value *= alpha_value;
-      green_value *= alpha_value;
-      blue_value *= alpha_value;
-
-      red_value *= 255.0f;
-      green_value *= 255.0f;
-      blue_value *= 255.0f;
-      alpha_value *= 255.0f;
-
-      *source++ = (((u32)alpha_value << 24) | ((u32)red_value << 16) |
-                   ((u32)green_value << 8) | ((u32)blue_value));
-    }
-  }
+  assert(header->compression == BI_RGB || header->compression == BI_BITFIELDS);
+  assert(header->bits_per_pixel == 24 || header->bits_per_pixel == 32);
+
+  // NOTE: A negative height means the rows are stored top-down. We always
+  // store bitmaps bottom-up to match the backbuffer.
+  bool top_down = header->height < 0;
+  int width = header->width;
+  int height = top_down ? -header->height : header->height;
+  // Source rows are padded to 4 bytes.
+  int source_pitch = ((width * header->bits_per_pixel + 31) / 32) * 4;
+  u8 *pixels = (u8 *)file.memory + header->bitmap_offset;
+  assert(header->bitmap_offset + (size_t)source_pitch * height <= file.size);
+
+  LoadedBitmap result = allocate_bitmap(width, height);
+  DecodeBitmapJob job = {
+      .decoder = bitmap_decoder(header),
+      .source = pixels,
+      .source_pitch = source_pitch,
+      .top_down = top_down,
+      .dest = &result,
+  };
+  job_parallel_for(height, DECODE_ROWS_PER_JOB, decode_bitmap_rows, &job);
+
+  win32_free_file(&file);
   return result;
 }
 
@@ -140,6 +329,33 @@ Dim win32_get_window_dimensions(HWND window) {
   return result;
 }
 
+typedef struct FillJob {
+  LoadedBitmap *buffer;
+  int min_x;
+  int max_x;
+  int min_y;
+  u32 color;
+} FillJob;
+
+static void fill_rows(void *data, u32 begin, u32 end) {
+  FillJob *job = (FillJob *)data;
+  char *row = ((char *)job->buffer->memory + (job->min_x * BYTES_PER_PIXEL) +
+               ((job->min_y + begin) * job->buffer->pitch));
+  int width = job->max_x - job->min_x;
+  LaneU32 color = lane_u32(job->color);
+  for (u32 y = begin; y < end; y++) {
+    u32 *pixel = (u32 *)row;
+    int x = 0;
+    for (; x + LANE_WIDTH <= width; x += LANE_WIDTH) {
+      lane_u32_storeu(pixel + x, color);
+    }
+    for (; x < width; x++) {
+      pixel[x] = job->color;
+    }
+    row += job->buffer->pitch;
+  }
+}
+
 void draw_rectangle(LoadedBitmap *buffer, int x, int y, int width, int height,
                     V4 color) {
   // clip the rectangle to the edges of the buffer.
@@ -147,18 +363,19 @@ void draw_rectangle(LoadedBitmap *buffer, int x, int y, int width, int height,
   int maxX = MAX(MIN(buffer->width, x + width), 0);
   int minY = MAX(0, y);
   int maxY = MAX(MIN(buffer->height, y + height), 0);
+  if (minX >= maxX || minY >= maxY) return;
 
-  char *row = ((char *)buffer->memory + (minX * BYTES_PER_PIXEL) +
-               (minY * buffer->pitch));
-  for (int y = minY; y < maxY; y++) {
-    u32 *pixel = (u32 *)row;
-    for (int x = minX; x < maxX; x++) {
-      int a_value = color.a * 255;
-      int r_value = color.r * 255;
-      int g_value = color.g * 255;
-      int b_value = color.b * 255;
-      *pixel++ = ((a_value << 24) | (r_value << 16) | (g_value << 8) | b_value);
-    }
-    row += buffer->pitch;
+  FillJob job = {
+      .buffer = buffer,
+      .min_x = minX,
+      .max_x = maxX,
+      .min_y = minY,
+      .color = u32_color_from_v4(color),
+  };
+  u32 rows = maxY - minY;
+  if ((maxX - minX) * rows >= PARALLEL_FILL_MIN_PIXELS) {
+    job_parallel_for(rows, FILL_ROWS_PER_JOB, fill_rows, &job);
+  } else {
+    fill_rows(&job, 0, rows);
   }
 }
@@ -35,9 +35,12 @@ typedef struct BitmapHeader {
   u32 colors_used;
   u32 colors_important;
 
+  // NOTE: Only present for BI_BITFIELDS. The alpha mask is only part of the
+  // header for BITMAPV3INFOHEADER and newer (size >= 56).
   u32 red_mask;
   u32 green_mask;
   u32 blue_mask;
+  u32 alpha_mask;
 } BitmapHeader;
 #pragma pack(pop)
 
@@ -46,9 +49,62 @@ typedef struct Win32Buffer {
   LoadedBitmap bitmap;
 } Win32Buffer;
 
+// NOTE: Every bitmap we allocate has its pitch padded to a multiple of this
+// many bytes, and its memory aligned to it, so SIMD kernels can always read
+// and write whole groups of 4 pixels.
+#define BITMAP_ALIGNMENT 16
+
+// Blends a premultiplied 0xAARRGGBB color over dest, with a rounded divide by
+// 255 done two channels at a time.
+static inline u32 blend_premultiplied(u32 dest, u32 source) {
+  u32 inverse_alpha = 255 - (source >> 24);
+  u32 rb = (dest & 0x00FF00FF) * inverse_alpha + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+  u32 ag = ((dest >> 8) & 0x00FF00FF) * inverse_alpha + 0x00800080;
+  ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+  return source + rb + ag;
+}
+
+// blend_premultiplied for LANE_WIDTH pixels at once.
+static inline LaneU32 lane_blend_premultiplied(LaneU32 dest, LaneU32 source) {
+  LaneF32 inverse_alpha =
+      lane_f32_sub(lane_f32(1.0f), lane_f32_mul(lane_unpack_channel(source, 24),
+                                                lane_f32(1.0f / 255.0f)));
+  LaneF32 r = lane_f32_add(lane_unpack_channel(source, 16),
+                           lane_f32_mul(lane_unpack_channel(dest, 16),
+                                        inverse_alpha));
+  LaneF32 g = lane_f32_add(lane_unpack_channel(source, 8),
+                           lane_f32_mul(lane_unpack_channel(dest, 8),
+                                        inverse_alpha));
+  LaneF32 b = lane_f32_add(lane_unpack_channel(source, 0),
+                           lane_f32_mul(lane_unpack_channel(dest, 0),
+                                        inverse_alpha));
+  LaneF32 a = lane_f32_add(lane_unpack_channel(source, 24),
+                           lane_f32_mul(lane_unpack_channel(dest, 24),
+                                        inverse_alpha));
+  return lane_pack_color(r, g, b, a);
+}
+
+LoadedBitmap allocate_bitmap(int width, int height);
+
+void free_bitmap(LoadedBitmap* bitmap);
+
+// Loads a 24 or 32 bit BI_RGB / BI_BITFIELDS bitmap (top-down or bottom-up)
+// into a freshly allocated bottom-up, premultiplied BGRA bitmap.
 LoadedBitmap load_bitmap(char* filename);
 
+// Blends count premultiplied source pixels over dest.
+void blend_pixels(u32* dest, u32* source, int count);
+
+// Blends a premultiplied bitmap into the buffer with its bottom left corner at
+// (pos_x, pos_y), clipped to the buffer.
+void draw_bitmap(LoadedBitmap* buffer, LoadedBitmap* bitmap, int pos_x,
+                 int pos_y);
+
 void draw_rectangle(LoadedBitmap* buffer, int x, int y, int width, int height,
                     V4 color);
 
+void win32_display_buffer_in_window(Win32Buffer* buffer, HDC hdc,
+                                    int windowWidth, int windowHeight);
+
 Dim win32_get_window_dimensions(HWND window);
@@ -3,6 +3,8 @@
 #include <Windows.h>
 #include <assert.h>
 
+#include "../memory/memory.h"
+
 LoadedFile win32_load_file(char *filename) {
   LoadedFile result = {0};
   HANDLE file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
@@ -11,12 +13,18 @@ LoadedFile win32_load_file(char *filename) {
   LARGE_INTEGER file_size64;
   assert(GetFileSizeEx(file_handle, &file_size64) != INVALID_FILE_SIZE);
   size_t file_size32 = file_size64.QuadPart;
-  result.memory =
-      VirtualAlloc(0, file_size32, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  result.memory = mem_virtual_alloc(MEMORY_TAG_IO, file_size32);
   DWORD bytes_read;
   assert(ReadFile(file_handle, result.memory, file_size32, &bytes_read, 0));
   assert(bytes_read == file_size32);
   result.size = file_size32;
+  CloseHandle(file_handle);
 
   return result;
 }
+
+void win32_free_file(LoadedFile *file) {
+  mem_virtual_free(file->memory);
+  file->memory = 0;
+  file->size = 0;
+}
@@ -7,3 +7,5 @@ typedef struct LoadedFile {
 } LoadedFile;
 
 LoadedFile win32_load_file(char *filename);
+
+void win32_free_file(LoadedFile *file);
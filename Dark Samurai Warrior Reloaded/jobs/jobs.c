@@ -0,0 +1,338 @@
+#include "./jobs.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../atomics.h"
+#include "../memory/memory.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#define THREAD_LOCAL __declspec(thread)
+typedef HANDLE Thread;
+typedef HANDLE Semaphore;
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+#define THREAD_LOCAL __thread
+typedef pthread_t Thread;
+typedef sem_t Semaphore;
+#endif
+
+// NOTE: Must be a power of two. A worker that fills its queue runs the job it
+// was trying to push itself, so this only bounds how much work can be stolen.
+#define JOB_QUEUE_SIZE 4096
+#define MAX_WORKERS 64
+#define SPINS_BEFORE_SLEEP 64
+
+typedef struct Job {
+  JobFunction function;
+  void *data;
+  u32 begin;
+  u32 end;
+  JobCounter *counter;
+} Job;
+
+// A Chase-Lev work stealing deque. The owning worker pushes and pops jobs at
+// the bottom, every other worker steals them from the top. top and bottom
+// live on separate cache lines so thieves don't fight the owner for them.
+typedef struct JobQueue {
+  volatile s64 top;
+  u8 top_padding[56];
+  volatile s64 bottom;
+  u8 bottom_padding[56];
+  Job jobs[JOB_QUEUE_SIZE];
+} JobQueue;
+
+typedef struct Worker {
+  JobQueue queue;
+  u32 index;
+  u32 random_state;
+  Thread thread;
+} Worker;
+
+typedef struct JobSystem {
+  Worker *workers;
+  u32 worker_count;
+  volatile s32 running;
+  volatile s32 sleeping;
+  Semaphore wake;
+} JobSystem;
+
+static JobSystem global_jobs;
+static THREAD_LOCAL Worker *local_worker;
+
+static bool queue_push(JobQueue *queue, Job *job) {
+  s64 bottom = queue->bottom;
+  s64 top = atomic_load_s64(&queue->top);
+  if (bottom - top >= JOB_QUEUE_SIZE) return false;
+  queue->jobs[bottom & (JOB_QUEUE_SIZE - 1)] = *job;
+  atomic_store_s64(&queue->bottom, bottom + 1);
+  return true;
+}
+
+static bool queue_pop(JobQueue *queue, Job *job) {
+  s64 bottom = queue->bottom - 1;
+  atomic_store_s64(&queue->bottom, bottom);
+  // NOTE: The store to bottom has to be visible before we read top, otherwise
+  // we and a thief can both take the last job.
+  atomic_full_barrier();
+  s64 top = atomic_load_s64(&queue->top);
+  if (top > bottom) {
+    atomic_store_s64(&queue->bottom, top);
+    return false;
+  }
+
+  *job = queue->jobs[bottom & (JOB_QUEUE_SIZE - 1)];
+  if (top == bottom) {
+    // This is the last job, so race the thieves for it.
+    bool won = atomic_compare_exchange_s64(&queue->top, top, top + 1);
+    atomic_store_s64(&queue->bottom, top + 1);
+    return won;
+  }
+  return true;
+}
+
+static bool queue_steal(JobQueue *queue, Job *job) {
+  s64 top = atomic_load_s64(&queue->top);
+  atomic_full_barrier();
+  s64 bottom = atomic_load_s64(&queue->bottom);
+  if (top >= bottom) return false;
+
+  // NOTE: The copy may be torn if the owner reused the slot, but then top has
+  // moved on and the compare exchange fails, so we never run it.
+  *job = queue->jobs[top & (JOB_QUEUE_SIZE - 1)];
+  return atomic_compare_exchange_s64(&queue->top, top, top + 1);
+}
+
+static u32 next_random(Worker *worker) {
+  // xorshift32
+  u32 x = worker->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  worker->random_state = x;
+  return x;
+}
+
+#ifdef _WIN32
+static u32 processor_count() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+}
+
+static void semaphore_init(Semaphore *semaphore) {
+  // NOTE: Submits can signal faster than sleepers wake up, so the count has
+  // no useful maximum. Going over one makes ReleaseSemaphore fail and wake no
+  // one at all.
+  *semaphore = CreateSemaphoreA(0, 0, LONG_MAX, 0);
+  assert(*semaphore);
+}
+
+static void semaphore_signal(Semaphore *semaphore, u32 count) {
+  BOOL released = ReleaseSemaphore(*semaphore, count, 0);
+  assert(released);
+}
+
+static void semaphore_wait(Semaphore *semaphore) {
+  WaitForSingleObject(*semaphore, INFINITE);
+}
+
+static void semaphore_destroy(Semaphore *semaphore) { CloseHandle(*semaphore); }
+
+static void thread_yield() { SwitchToThread(); }
+#else
+static u32 processor_count() { return (u32)sysconf(_SC_NPROCESSORS_ONLN); }
+
+static void semaphore_init(Semaphore *semaphore) {
+  int error = sem_init(semaphore, 0, 0);
+  assert(error == 0);
+}
+
+static void semaphore_signal(Semaphore *semaphore, u32 count) {
+  for (u32 i = 0; i < count; i++) sem_post(semaphore);
+}
+
+static void semaphore_wait(Semaphore *semaphore) {
+  while (sem_wait(semaphore) != 0) {
+  }
+}
+
+static void semaphore_destroy(Semaphore *semaphore) { sem_destroy(semaphore); }
+
+static void thread_yield() { sched_yield(); }
+#endif
+
+static void job_execute(Job *job) {
+  job->function(job->data, job->begin, job->end);
+  if (job->counter) atomic_add_s32(&job->counter->remaining, -1);
+}
+
+static bool job_try_steal(Worker *thief, Job *job) {
+  u32 count = global_jobs.worker_count;
+  u32 start = next_random(thief) % count;
+  for (u32 i = 0; i < count; i++) {
+    Worker *victim = &global_jobs.workers[(start + i) % count];
+    if (victim != thief && queue_steal(&victim->queue, job)) return true;
+  }
+  return false;
+}
+
+static bool job_try_run_one(Worker *worker) {
+  Job job;
+  if (queue_pop(&worker->queue, &job) || job_try_steal(worker, &job)) {
+    job_execute(&job);
+    return true;
+  }
+  return false;
+}
+
+static void worker_loop(Worker *worker) {
+  local_worker = worker;
+  while (atomic_load_s32(&global_jobs.running)) {
+    bool ran = false;
+    for (int spin = 0; spin < SPINS_BEFORE_SLEEP && !ran; spin++) {
+      ran = job_try_run_one(worker);
+      if (!ran) cpu_pause();
+    }
+    if (ran) continue;
+
+    // NOTE: Announce that we are going to sleep before looking one last time,
+    // so a submit that we miss here is guaranteed to see us and wake us up.
+    atomic_add_s32(&global_jobs.sleeping, 1);
+    if (!job_try_run_one(worker) && atomic_load_s32(&global_jobs.running)) {
+      semaphore_wait(&global_jobs.wake);
+    }
+    atomic_add_s32(&global_jobs.sleeping, -1);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_thread_proc(LPVOID parameter) {
+  worker_loop((Worker *)parameter);
+  return 0;
+}
+
+static void thread_start(Worker *worker) {
+  worker->thread = CreateThread(0, 0, worker_thread_proc, worker, 0, 0);
+  assert(worker->thread);
+}
+
+static void thread_join(Worker *worker) {
+  WaitForSingleObject(worker->thread, INFINITE);
+  CloseHandle(worker->thread);
+}
+#else
+static void *worker_thread_proc(void *parameter) {
+  worker_loop((Worker *)parameter);
+  return 0;
+}
+
+static void thread_start(Worker *worker) {
+  int error = pthread_create(&worker->thread, 0, worker_thread_proc, worker);
+  assert(error == 0);
+}
+
+static void thread_join(Worker *worker) { pthread_join(worker->thread, 0); }
+#endif
+
+void jobs_init(u32 worker_count) {
+  assert(!global_jobs.workers);
+  if (!worker_count) worker_count = processor_count();
+  worker_count = MIN(MAX(worker_count, 1), MAX_WORKERS);
+
+  global_jobs.workers =
+      (Worker *)mem_alloc(MEMORY_TAG_JOBS, worker_count * sizeof(Worker));
+  assert(global_jobs.workers);
+  memset(global_jobs.workers, 0, worker_count * sizeof(Worker));
+  global_jobs.worker_count = worker_count;
+  global_jobs.running = 1;
+  semaphore_init(&global_jobs.wake);
+
+  for (u32 i = 0; i < worker_count; i++) {
+    Worker *worker = &global_jobs.workers[i];
+    worker->index = i;
+    worker->random_state = 0x9E3779B9u * (i + 1);
+  }
+  // The calling thread is worker 0, it runs jobs whenever it waits.
+  local_worker = &global_jobs.workers[0];
+  for (u32 i = 1; i < worker_count; i++) {
+    thread_start(&global_jobs.workers[i]);
+  }
+}
+
+void jobs_shutdown() {
+  if (!global_jobs.workers) return;
+  atomic_store_s32(&global_jobs.running, 0);
+  semaphore_signal(&global_jobs.wake, global_jobs.worker_count);
+  for (u32 i = 1; i < global_jobs.worker_count; i++) {
+    thread_join(&global_jobs.workers[i]);
+  }
+  semaphore_destroy(&global_jobs.wake);
+  mem_free(global_jobs.workers);
+  global_jobs.workers = 0;
+  global_jobs.worker_count = 0;
+  local_worker = 0;
+}
+
+u32 jobs_worker_count() { return MAX(global_jobs.worker_count, 1); }
+
+s32 jobs_worker_index() { return local_worker ? (s32)local_worker->index : -1; }
+
+void job_submit(JobFunction function, void *data, u32 begin, u32 end,
+                JobCounter *counter) {
+  Job job = {.function = function,
+             .data = data,
+             .begin = begin,
+             .end = end,
+             .counter = counter};
+  if (counter) atomic_add_s32(&counter->remaining, 1);
+
+  Worker *worker = local_worker;
+  if (!worker || !queue_push(&worker->queue, &job)) {
+    job_execute(&job);
+    return;
+  }
+
+  // NOTE: Pairs with the sleeping announcement in worker_loop.
+  atomic_full_barrier();
+  if (atomic_load_s32(&global_jobs.sleeping) > 0) {
+    semaphore_signal(&global_jobs.wake, 1);
+  }
+}
+
+void job_wait(JobCounter *counter) {
+  Worker *worker = local_worker;
+  while (atomic_load_s32(&counter->remaining) > 0) {
+    if (worker) {
+      if (!job_try_run_one(worker)) cpu_pause();
+    } else {
+      thread_yield();
+    }
+  }
+}
+
+void job_parallel_for(u32 count, u32 batch_size, JobFunction function,
+                      void *data) {
+  if (!count) return;
+  if (!batch_size) {
+    // A few batches per worker so stealing can even out uneven batches.
+    u32 batch_count = jobs_worker_count() * 4;
+    batch_size = MAX((count + batch_count - 1) / batch_count, 1);
+  }
+  if (batch_size >= count) {
+    function(data, 0, count);
+    return;
+  }
+
+  JobCounter counter = {0};
+  for (u32 begin = 0; begin < count; begin += batch_size) {
+    u32 end = MIN(begin + batch_size, count);
+    job_submit(function, data, begin, end, &counter);
+  }
+  job_wait(&counter);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "../common.h"
+
+// NOTE: Every job works on a range [begin, end) of whatever data it is handed.
+// Single jobs that don't care about a range just ignore it.
+typedef void (*JobFunction)(void *data, u32 begin, u32 end);
+
+// Counts the jobs that have been submitted against it but not finished yet.
+// Zero initialize it, submit jobs against it, then job_wait on it.
+typedef struct JobCounter {
+  volatile s32 remaining;
+} JobCounter;
+
+// Starts one worker per core (or worker_count if it is non-zero). The calling
+// thread becomes worker 0 and runs jobs whenever it waits.
+void jobs_init(u32 worker_count);
+
+void jobs_shutdown();
+
+u32 jobs_worker_count();
+
+// Index of the calling worker, or -1 for threads that aren't workers.
+s32 jobs_worker_index();
+
+// Pushes a job onto the calling worker's queue where idle workers can steal
+// it. Threads that aren't workers, and calls made before jobs_init, run the
+// job immediately instead.
+void job_submit(JobFunction function, void *data, u32 begin, u32 end,
+                JobCounter *counter);
+
+// Runs queued jobs on the calling thread until the counter reaches zero.
+void job_wait(JobCounter *counter);
+
+// Splits [0, count) into batches of batch_size (0 picks one based on the
+// worker count), runs them across all workers and waits for them to finish.
+void job_parallel_for(u32 count, u32 batch_size, JobFunction function,
+                      void *data);
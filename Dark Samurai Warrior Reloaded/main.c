@@ -3,17 +3,23 @@
 #include <stdio.h>
 #include <windows.h>
 
+#include "audio/output.h"
 #include "common.h"
 #include "gfx/gfx.h"
 #include "input/input.h"
 #include "io/file.h"
+#include "jobs/jobs.h"
 #include "math.h"
+#include "memory/memory.h"
+#include "nav/nav.h"
 
 typedef enum State { OVERWORLD, BATTLE } State;
 
 typedef struct NPC {
   int x;
   int y;
+  int size;
+  int speed;
   const char *Name;
   V4 color;
 } NPC;
@@ -24,7 +30,6 @@ typedef struct Player {
   int speed;
 } Player;
 
-static Win32Buffer global_backbuffer;
 static bool global_running;
 // NOTE: This is a value that tells you how often Windows queries performance
 // counters. It is determined at system boot and never changes, so it only needs
@@ -49,6 +54,73 @@ inline float win32_get_seconds_elapsed(LARGE_INTEGER start, LARGE_INTEGER end) {
       ((float)(end.QuadPart - start.QuadPart) / (float)performance_frequency);
   return result;
 }
+
+// Moves from toward to by at most step.
+static int approach(int from, int to, int step) {
+  if (to > from) return from + MIN(to - from, step);
+  return from - MIN(from - to, step);
+}
+
+// Walks the NPC one frame along the flow field toward the field's goal.
+static void follow_flow_field(NPC *npc, NavGrid *nav, NavFlowField *field) {
+  float half_size = npc->size / 2.0f;
+  s32 cell = nav_cell_at(nav, v2(npc->x + half_size, npc->y + half_size));
+  if (cell < 0) return;
+  V2 target = nav_cell_center(nav, nav_flow_step(nav, field, cell));
+  npc->x = approach(npc->x, (int)(target.x - half_size), npc->speed);
+  npc->y = approach(npc->y, (int)(target.y - half_size), npc->speed);
+}
+
+typedef struct ChaseJob {
+  NPC *npcs;
+  NavGrid *nav;
+  NavFlowField *field;
+} ChaseJob;
+
+static void chase_job(void *data, u32 begin, u32 end) {
+  ChaseJob *job = (ChaseJob *)data;
+  for (u32 i = begin; i < end; i++) {
+    follow_flow_field(&job->npcs[i], job->nav, job->field);
+  }
+}
+
+// A short burst of filtered noise that dies away, for sword hits until there
+// are real sound assets.
+static Sound make_hit_sound() {
+  Sound result = allocate_sound(AUDIO_SAMPLE_RATE / 4, 1);
+  u32 random_state = 0x2545F491;
+  float amplitude = 1.0f;
+  float low = 0.0f;
+  for (u32 i = 0; i < result.frame_count; i++) {
+    // xorshift32, like the particles.
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    float noise = (float)(random_state >> 8) / (float)(1 << 23) - 1.0f;
+    // One pole low pass to take the hiss off.
+    low += 0.3f * (noise - low);
+    result.left[i] = low * amplitude;
+    // About -57 dB by the end.
+    amplitude *= 0.99945f;
+  }
+  return result;
+}
+
+#if MEMORY_TRACKING
+// Shows current and peak KB and live allocation count for every subsystem.
+static void draw_memory_overlay(LoadedBitmap *buffer, Font *font, int x,
+                                int y) {
+  char line[64];
+  for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    MemoryStats stats = memory_get_stats(tag);
+    sprintf_s(line, sizeof(line), "%-6s %5zuK/%5zuK %u", memory_tag_name(tag),
+              stats.current / 1024, stats.peak / 1024, stats.count);
+    draw_text(buffer, font, x, y, line, v4(1.0f, 0.9f, 0.3f, 1.0f));
+    y -= font->line_gap;
+  }
+}
+#endif
+
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
                             LPARAM lParam) {
   LRESULT result = 0;
@@ -76,31 +148,17 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
   win32_initialize_performance_frequency();
 
+  jobs_init(0);
+
   Font test_font = win32_load_font("Consolas");
 
-  Win32Buffer global_backbuffer = {
-      .bitmap.width = 960,
-      .bitmap.height = 540,
-      .bitmap.pitch = global_backbuffer.bitmap.width * BYTES_PER_PIXEL,
-      .bitmap.memory =
-          VirtualAlloc(0,
-                       global_backbuffer.bitmap.width *
-                           global_backbuffer.bitmap.height * BYTES_PER_PIXEL,
-                       MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE),
-  };
+  int backbuffer_width = 960;
+  int backbuffer_height = 540;
 
-  BITMAPINFO info = {.bmiHeader = {
-                         .biSize = sizeof(global_backbuffer.info.bmiHeader),
-                         .biWidth = global_backbuffer.bitmap.width,
-                         .biHeight = global_backbuffer.bitmap.height,
-                         .biPlanes = 1,
-                         .biBitCount = BYTES_PER_PIXEL * 8,
-                         .biCompression = BI_RGB,
-                     }};
-  global_backbuffer.info = info;
-  assert(global_backbuffer.bitmap.memory);
-
-  WNDCLASS wc = {.lpfnWndProc = WindowProc,
+  // NOTE: CS_OWNDC lets the present thread hold on to one DC for the life of
+  // the window.
+  WNDCLASS wc = {.style = CS_OWNDC,
+                 .lpfnWndProc = WindowProc,
                  .hInstance = hInstance,
                  .lpszClassName = L"My Cool Window Class"};
 
@@ -117,6 +175,9 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
   ShowWindow(hwnd, nCmdShow);
 
+  Win32Presenter presenter = {0};
+  win32_start_presenter(&presenter, hwnd, backbuffer_width, backbuffer_height);
+
   float target_seconds_per_frame = 1.0f / 60.0f;
 
   LARGE_INTEGER last_counter = win32_get_wall_clock();
@@ -127,14 +188,82 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
   State state = OVERWORLD;
 
-  NPC tim = {
-      .Name = "Tim", .x = 400, .y = 300, .color = v4(0.55f, 0.25f, 0.8f, 1.0f)};
+  NPC npcs[] = {
+      {.Name = "Tim",
+       .x = 400,
+       .y = 300,
+       .size = 20,
+       .speed = 3,
+       .color = v4(0.55f, 0.25f, 0.8f, 1.0f)},
+      {.Name = "Bandit",
+       .x = 800,
+       .y = 100,
+       .size = 16,
+       .speed = 2,
+       .color = v4(0.7f, 0.2f, 0.15f, 1.0f)},
+      {.Name = "Bandit",
+       .x = 850,
+       .y = 450,
+       .size = 16,
+       .speed = 2,
+       .color = v4(0.7f, 0.2f, 0.15f, 1.0f)},
+      {.Name = "Bandit",
+       .x = 100,
+       .y = 480,
+       .size = 16,
+       .speed = 2,
+       .color = v4(0.7f, 0.2f, 0.15f, 1.0f)},
+  };
   Player player = {.x = 200, .y = 200, .speed = 20};
-  LoadedBitmap guy_bmp = load_bitmap("..\\assets\\guy.bmp");
+  // TODO: guy.bmp is a single pose. Cut real sheets into frames here once we
+  // have them.
+  SpriteSheet guy_sheet =
+      load_sprite_sheet("..\\assets\\guy.bmp", 64, 128, 1.0f);
+  u32 guy_idle = add_sprite_animation(&guy_sheet, 0, 1, 1.0f, true);
+  AnimationTable characters = {0};
+  init_animation_table(&characters, &guy_sheet, 256);
+  s32 player_sprite =
+      add_animation_instance(&characters, guy_idle, player.x, player.y);
+
+  ParticleSystem particles = {0};
+  init_particles(&particles, 64 * 1024, 2, (V2){0.0f, -20.0f});
+  ParticleEmitter snow = {.pos = {0.0f, (float)backbuffer_height},
+                          .extent = {(float)backbuffer_width, 0.0f},
+                          .velocity = {10.0f, -40.0f},
+                          .spread = {15.0f, 10.0f},
+                          .lifetime = 12.0f,
+                          .rate = 300.0f,
+                          .color = v4(1.0f, 1.0f, 1.0f, 0.8f)};
+  ParticleEmitter sword_hit = {.spread = {250.0f, 250.0f},
+                               .lifetime = 0.6f,
+                               .color = v4(1.0f, 0.7f, 0.2f, 1.0f)};
+
+  int tile_size = 20;
+  NavGrid nav = {0};
+  init_nav_grid(&nav, backbuffer_width / tile_size,
+                backbuffer_height / tile_size, tile_size);
+  // A wall for the NPCs to find their way around.
+  for (int y = 6; y < 20; y++) nav_set_walkable(&nav, 30, y, false);
+  for (int x = 22; x < 30; x++) nav_set_walkable(&nav, x, 19, false);
+  const V4 wall_color = v4(0.3f, 0.35f, 0.3f, 1.0f);
+
+  Lighting lighting = {0};
+  init_lighting(&lighting, backbuffer_width, backbuffer_height);
+
+  Audio audio = {0};
+  init_audio(&audio);
+  AudioOutput audio_output = {0};
+  if (!win32_open_audio_device(&audio_output, &audio.ring)) {
+    // NOTE: No device, so keep mixing and throw it away. The game runs the
+    // same either way.
+    open_null_audio_output(&audio_output, &audio.ring);
+  }
+  Sound hit_sound = make_hit_sound();
 
   UI ui = {0};
 
   Input input = {0};
+  State last_state = state;
   while (global_running) {
     input.seconds_per_frame = target_seconds_per_frame;
 
@@ -156,41 +285,117 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     // TODO: (David) figure out the best way to handle y coords.
     // For now, translate y value to account for 0,0 being bottom left instead
     // of top left
-    ui.mousePos.y = global_backbuffer.bitmap.height - ui.mousePos.y;
+    ui.mousePos.y = backbuffer_height - ui.mousePos.y;
 
-    HDC dc = GetDC(hwnd);
-    Dim dim = win32_get_window_dimensions(hwnd);
+    LoadedBitmap *backbuffer = win32_back_buffer(&presenter);
 
     const V4 background = state == OVERWORLD ? v4(0.5f, 0.9f, 0.6f, 1.0f)
                                              : v4(0.0f, 0.0f, 0.2f, 1.0f);
 
     // clear screen
-    draw_rectangle(&global_backbuffer.bitmap, 0, 0, dim.width, dim.height,
+    draw_rectangle(backbuffer, 0, 0, backbuffer->width, backbuffer->height,
                    background);
 
+    V2 player_center = v2(player.x + guy_sheet.frame_width / 2.0f,
+                          player.y + guy_sheet.frame_height / 2.0f);
+
+    // draw player
+    characters.x[player_sprite] = player.x;
+    characters.y[player_sprite] = player.y;
+    update_animations(&characters, input.seconds_per_frame);
+    draw_animations(backbuffer, &characters);
+
+    // effects
+    if (state == OVERWORLD) {
+      emit_particles(&particles, &snow, input.seconds_per_frame);
+    }
+    if (state == BATTLE && last_state != BATTLE) {
+      sword_hit.pos = player_center;
+      burst_particles(&particles, &sword_hit, 2000);
+      float pan = 2.0f * player_center.x / backbuffer_width - 1.0f;
+      play_sound(&audio, &hit_sound, 0.8f, MIN(MAX(pan, -1.0f), 1.0f), false);
+    }
+    last_state = state;
+    update_particles(&particles, input.seconds_per_frame);
+    draw_particles(backbuffer, &particles);
+
+    if (state == OVERWORLD) {
+      // NOTE: One field per goal is shared by everyone chasing the player, and
+      // it is only rebuilt when the player moves to another tile.
+      s32 player_cell = nav_cell_at(&nav, player_center);
+      if (player_cell >= 0) {
+        // NOTE: The field is built here on the main thread. After that every
+        // NPC only reads it, so they can all move on the job system at once.
+        ChaseJob chase = {.npcs = npcs,
+                          .nav = &nav,
+                          .field = nav_flow_field(&nav, player_cell)};
+        job_parallel_for(array_length(npcs), 0, chase_job, &chase);
+      }
+
+      for (u32 cell = 0; cell < nav.cell_count; cell++) {
+        if (nav.walkable[cell]) continue;
+        draw_rectangle(backbuffer, (cell % nav.width) * tile_size,
+                       (cell / nav.width) * tile_size, tile_size, tile_size,
+                       wall_color);
+      }
+
+      // draw NPCs
+      for (u32 i = 0; i < array_length(npcs); i++) {
+        NPC *npc = &npcs[i];
+        draw_rectangle(backbuffer, npc->x, npc->y, npc->size, npc->size,
+                       npc->color);
+      }
+    }
+    nav_next_frame(&nav);
+
+    if (state == OVERWORLD) {
+      begin_lighting(&lighting, v3(0.8f, 0.8f, 0.85f));
+      add_point_light(&lighting, player_center, 220.0f, v3(0.5f, 0.4f, 0.2f));
+      for (u32 cell = 0; cell < nav.cell_count; cell++) {
+        if (nav.walkable[cell]) continue;
+        add_light_occluder(&lighting, (cell % nav.width) * tile_size,
+                           (cell / nav.width) * tile_size, tile_size,
+                           tile_size);
+      }
+    } else {
+      begin_lighting(&lighting, v3(0.25f, 0.25f, 0.35f));
+      // torches
+      add_point_light(&lighting, v2(100.0f, 450.0f), 320.0f,
+                      v3(1.0f, 0.6f, 0.25f));
+      add_point_light(&lighting, v2(860.0f, 450.0f), 320.0f,
+                      v3(1.0f, 0.6f, 0.25f));
+      // The samurai's sword glints to the right.
+      add_spot_light(&lighting, player_center, 400.0f, v3(0.6f, 0.7f, 1.0f),
+                     v2(1.0f, 0.0f), 0.85f);
+    }
+    apply_lighting(backbuffer, &lighting);
+
     // draw UI
+    // NOTE: UI and text go on after lighting, so the lightmap never darkens
+    // the HUD.
     V2 buttonPos = {50, 50};
     V4 buttonColor = v4(1.0, 0.0, 0.0, 1.0);
     const char *buttonText = state == OVERWORLD ? "Overworld" : "Battle";
     int buttonWidth = 150;
     int buttonHeight = 150;
-    if (button(&ui, 69, &global_backbuffer.bitmap, buttonPos, buttonWidth,
-               buttonHeight, buttonColor, &test_font, buttonText)) {
+    if (button(&ui, 69, backbuffer, buttonPos, buttonWidth, buttonHeight,
+               buttonColor, &test_font, buttonText)) {
       // If I press this red button dawg, everybody heaven's gated.
       state = state == OVERWORLD ? BATTLE : OVERWORLD;
     }
 
-    // draw player
-    draw_bitmap(&global_backbuffer.bitmap, &guy_bmp, player.x, player.y);
-
-    draw_string(&global_backbuffer.bitmap, &test_font, 350, 350,
+    draw_string(backbuffer, &test_font, 350, 350,
                 "sneed's feed and seed\nformerly chuck's");
 
-    if (state == OVERWORLD) {
-      // draw TIM
-      draw_rectangle(&global_backbuffer.bitmap, tim.x, tim.y, 20, 20,
-                     tim.color);
-    }
+#if MEMORY_TRACKING
+    draw_memory_overlay(backbuffer, &test_font, 540, 500);
+#endif
+
+    // NOTE: Only a couple of frames are ever queued, so sounds started this
+    // frame are heard within that.
+    update_audio(&audio, target_seconds_per_frame);
+    pump_audio_output(&audio_output,
+                      (u32)(target_seconds_per_frame * AUDIO_SAMPLE_RATE));
 
     // TODO: This frame-rate code is still very incomplete, but it is at least
     // enforcing a frame rate for now.
@@ -204,6 +409,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     } else {
       // TODO: Missed Framerate. Should log here or something maybe.
     }
+
+    // NOTE: Present right after the pacing wait. The present thread blits this
+    // frame while we start on the next one.
+    win32_present(&presenter);
+
     LARGE_INTEGER end_counter = win32_get_wall_clock();
     float frame_time =
         1000.0f * win32_get_seconds_elapsed(counter, end_counter);
@@ -212,11 +422,20 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
               "Frame Time: %.2f \n", frame_time);
     OutputDebugStringA(frame_time_buffer);
     last_counter = end_counter;
-
-    win32_display_buffer_in_window(&global_backbuffer, dc, dim.width,
-                                   dim.height);
-    ReleaseDC(hwnd, dc);
   }
 
+  close_audio_output(&audio_output);
+  free_sound(&hit_sound);
+  free_audio(&audio);
+  free_lighting(&lighting);
+  free_nav_grid(&nav);
+  free_particles(&particles);
+  free_animation_table(&characters);
+  free_sprite_sheet(&guy_sheet);
+  free_font(&test_font);
+  win32_stop_presenter(&presenter);
+  jobs_shutdown();
+  memory_report_leaks();
+
   return 0;
 }
\ No newline at end of file
@@ -1,4 +1,35 @@
 #pragma once
+#include <emmintrin.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+
+// NOTE: Everything in here is static inline so the per-pixel kernels don't pay
+// for a function call per operation. The vector types are plain structs, so
+// they can be passed by value on every target. The operations load them into
+// __m128 registers.
+
+typedef struct V2 {
+  float x, y;
+} V2;
+
+typedef union V3 {
+  struct {
+    float x;
+    float y;
+    float z;
+  };
+  struct {
+    float r;
+    float g;
+    float b;
+  };
+  float e[3];
+} V3;
+
 typedef union V4 {
   struct {
     float r;
@@ -12,14 +43,428 @@ typedef union V4 {
     float z;
     float w;
   };
+  float e[4];
 } V4;
 
-typedef struct V2 {
-  float x, y;
-} V2;
+// Row major, points are column vectors: p' = M * (x, y, 1).
+typedef struct M3x3 {
+  float e[3][3];
+} M3x3;
+
+// NOTE: Uses the SSE instruction instead of the CRT's sqrtf.
+static inline float square_root(float value) {
+  return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(value)));
+}
+
+//
+// V2
+//
+
+static inline V2 v2(float x, float y) {
+  V2 result = {x, y};
+  return result;
+}
+
+static inline V2 v2_add(V2 a, V2 b) { return v2(a.x + b.x, a.y + b.y); }
+
+static inline V2 v2_sub(V2 a, V2 b) { return v2(a.x - b.x, a.y - b.y); }
+
+static inline V2 v2_mul(V2 v, float scaler) {
+  return v2(v.x * scaler, v.y * scaler);
+}
+
+static inline V2 v2_hadamard(V2 a, V2 b) { return v2(a.x * b.x, a.y * b.y); }
+
+static inline float v2_dot(V2 a, V2 b) { return a.x * b.x + a.y * b.y; }
+
+static inline float v2_length_squared(V2 v) { return v2_dot(v, v); }
+
+static inline float v2_length(V2 v) { return square_root(v2_dot(v, v)); }
+
+// Returns v unchanged if it has no length.
+static inline V2 v2_normalize(V2 v) {
+  float length = v2_length(v);
+  return length > 0.0f ? v2_mul(v, 1.0f / length) : v;
+}
+
+static inline V2 v2_lerp(V2 a, float t, V2 b) {
+  return v2_add(v2_mul(a, 1.0f - t), v2_mul(b, t));
+}
+
+//
+// V3
+//
+
+static inline V3 v3(float x, float y, float z) {
+  V3 result = {.x = x, .y = y, .z = z};
+  return result;
+}
+
+static inline V3 v3_add(V3 a, V3 b) {
+  return v3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+static inline V3 v3_sub(V3 a, V3 b) {
+  return v3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static inline V3 v3_mul(V3 v, float scaler) {
+  return v3(v.x * scaler, v.y * scaler, v.z * scaler);
+}
+
+static inline V3 v3_hadamard(V3 a, V3 b) {
+  return v3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+static inline float v3_dot(V3 a, V3 b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline V3 v3_cross(V3 a, V3 b) {
+  return v3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x);
+}
+
+//
+// V4
+//
+
+static inline __m128 v4_load(V4 v) { return _mm_loadu_ps(v.e); }
+
+static inline V4 v4_store(__m128 m) {
+  V4 result;
+  _mm_storeu_ps(result.e, m);
+  return result;
+}
+
+static inline V4 v4(float r, float g, float b, float a) {
+#ifdef _DEBUG
+  assert(r <= 1.0f && r >= 0.0f);
+  assert(g <= 1.0f && g >= 0.0f);
+  assert(b <= 1.0f && b >= 0.0f);
+  assert(a <= 1.0f && a >= 0.0f);
+#endif
+  V4 result = {.r = r, .g = g, .b = b, .a = a};
+  return result;
+}
+
+static inline V4 v4_mul(V4 v4, float scaler) {
+  return v4_store(_mm_mul_ps(v4_load(v4), _mm_set1_ps(scaler)));
+}
+
+static inline V4 v4_add(V4 a, V4 b) {
+  return v4_store(_mm_add_ps(v4_load(a), v4_load(b)));
+}
+
+static inline V4 v4_sub(V4 a, V4 b) {
+  return v4_store(_mm_sub_ps(v4_load(a), v4_load(b)));
+}
+
+static inline V4 v4_hadamard(V4 a, V4 b) {
+  return v4_store(_mm_mul_ps(v4_load(a), v4_load(b)));
+}
+
+static inline V4 v4_lerp(V4 a, float t, V4 b) {
+  __m128 result = _mm_add_ps(_mm_mul_ps(v4_load(a), _mm_set1_ps(1.0f - t)),
+                             _mm_mul_ps(v4_load(b), _mm_set1_ps(t)));
+  return v4_store(result);
+}
+
+static inline V4 v4_clamp01(V4 v) {
+  __m128 result = _mm_min_ps(_mm_max_ps(v4_load(v), _mm_setzero_ps()),
+                             _mm_set1_ps(1.0f));
+  return v4_store(result);
+}
+
+// Unpacks a 0xAARRGGBB pixel into 0..1 floats.
+static inline V4 v4_color_from_u32(u32 color) {
+  __m128i channels = _mm_set_epi32(color >> 24, (color >> 0) & 0xFF,
+                                   (color >> 8) & 0xFF, (color >> 16) & 0xFF);
+  return v4_store(
+      _mm_mul_ps(_mm_cvtepi32_ps(channels), _mm_set1_ps(1.0f / 255.0f)));
+}
+
+// Packs a 0..1 color into a 0xAARRGGBB pixel, rounding each channel.
+static inline u32 u32_color_from_v4(V4 color) {
+  __m128i channels = _mm_cvtps_epi32(
+      _mm_mul_ps(v4_load(v4_clamp01(color)), _mm_set1_ps(255.0f)));
+  // rgba -> bgra, then narrow each 32 bit channel to a byte.
+  channels = _mm_shuffle_epi32(channels, _MM_SHUFFLE(3, 0, 1, 2));
+  channels = _mm_packs_epi32(channels, channels);
+  channels = _mm_packus_epi16(channels, channels);
+  return (u32)_mm_cvtsi128_si32(channels);
+}
+
+//
+// M3x3
+//
+
+static inline M3x3 m3x3_identity() {
+  M3x3 result = {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
+  return result;
+}
+
+static inline M3x3 m3x3_translation(V2 offset) {
+  M3x3 result = {{{1, 0, offset.x}, {0, 1, offset.y}, {0, 0, 1}}};
+  return result;
+}
+
+static inline M3x3 m3x3_scale(V2 scale) {
+  M3x3 result = {{{scale.x, 0, 0}, {0, scale.y, 0}, {0, 0, 1}}};
+  return result;
+}
+
+// Takes the sine and cosine instead of an angle so callers pick their own
+// trig.
+static inline M3x3 m3x3_rotation(float sine, float cosine) {
+  M3x3 result = {{{cosine, -sine, 0}, {sine, cosine, 0}, {0, 0, 1}}};
+  return result;
+}
+
+static inline M3x3 m3x3_mul(M3x3 a, M3x3 b) {
+  M3x3 result;
+  for (int row = 0; row < 3; row++) {
+    for (int column = 0; column < 3; column++) {
+      result.e[row][column] = a.e[row][0] * b.e[0][column] +
+                              a.e[row][1] * b.e[1][column] +
+                              a.e[row][2] * b.e[2][column];
+    }
+  }
+  return result;
+}
+
+static inline V3 m3x3_transform(M3x3 m, V3 v) {
+  return v3(m.e[0][0] * v.x + m.e[0][1] * v.y + m.e[0][2] * v.z,
+            m.e[1][0] * v.x + m.e[1][1] * v.y + m.e[1][2] * v.z,
+            m.e[2][0] * v.x + m.e[2][1] * v.y + m.e[2][2] * v.z);
+}
+
+static inline V2 m3x3_transform_point(M3x3 m, V2 p) {
+  return v2(m.e[0][0] * p.x + m.e[0][1] * p.y + m.e[0][2],
+            m.e[1][0] * p.x + m.e[1][1] * p.y + m.e[1][2]);
+}
+
+//
+// Lanes
+//
+// A lane holds LANE_WIDTH values that are processed together. Kernels are
+// written once against these and get 8 wide AVX2 when the compiler targets it
+// (/arch:AVX2) and 4 wide SSE2 otherwise. Comparisons return a LaneF32 mask
+// with all bits set in the lanes where they are true.
+
+#if defined(__AVX2__)
+#define LANE_WIDTH 8
+typedef __m256 LaneF32;
+typedef __m256i LaneU32;
+
+static inline LaneF32 lane_f32(float value) { return _mm256_set1_ps(value); }
+static inline LaneF32 lane_f32_load(const float *memory) {
+  return _mm256_load_ps(memory);
+}
+static inline void lane_f32_store(float *memory, LaneF32 value) {
+  _mm256_store_ps(memory, value);
+}
+static inline LaneF32 lane_f32_loadu(const float *memory) {
+  return _mm256_loadu_ps(memory);
+}
+static inline void lane_f32_storeu(float *memory, LaneF32 value) {
+  _mm256_storeu_ps(memory, value);
+}
+static inline LaneF32 lane_f32_add(LaneF32 a, LaneF32 b) {
+  return _mm256_add_ps(a, b);
+}
+static inline LaneF32 lane_f32_sub(LaneF32 a, LaneF32 b) {
+  return _mm256_sub_ps(a, b);
+}
+static inline LaneF32 lane_f32_mul(LaneF32 a, LaneF32 b) {
+  return _mm256_mul_ps(a, b);
+}
+static inline LaneF32 lane_f32_div(LaneF32 a, LaneF32 b) {
+  return _mm256_div_ps(a, b);
+}
+static inline LaneF32 lane_f32_min(LaneF32 a, LaneF32 b) {
+  return _mm256_min_ps(a, b);
+}
+static inline LaneF32 lane_f32_max(LaneF32 a, LaneF32 b) {
+  return _mm256_max_ps(a, b);
+}
+static inline LaneF32 lane_f32_sqrt(LaneF32 a) { return _mm256_sqrt_ps(a); }
+static inline LaneF32 lane_f32_less(LaneF32 a, LaneF32 b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+static inline LaneF32 lane_f32_less_equal(LaneF32 a, LaneF32 b) {
+  return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+static inline LaneF32 lane_f32_greater(LaneF32 a, LaneF32 b) {
+  return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+static inline LaneF32 lane_mask_and(LaneF32 a, LaneF32 b) {
+  return _mm256_and_ps(a, b);
+}
+static inline LaneF32 lane_mask_or(LaneF32 a, LaneF32 b) {
+  return _mm256_or_ps(a, b);
+}
+// mask ? a : b
+static inline LaneF32 lane_f32_select(LaneF32 mask, LaneF32 a, LaneF32 b) {
+  return _mm256_blendv_ps(b, a, mask);
+}
+// One bit per lane, set where the mask is true.
+static inline int lane_mask_bits(LaneF32 mask) {
+  return _mm256_movemask_ps(mask);
+}
+
+static inline LaneU32 lane_u32(u32 value) {
+  return _mm256_set1_epi32((int)value);
+}
+static inline LaneU32 lane_u32_load(const u32 *memory) {
+  return _mm256_load_si256((const __m256i *)memory);
+}
+static inline LaneU32 lane_u32_loadu(const u32 *memory) {
+  return _mm256_loadu_si256((const __m256i *)memory);
+}
+static inline void lane_u32_store(u32 *memory, LaneU32 value) {
+  _mm256_store_si256((__m256i *)memory, value);
+}
+static inline void lane_u32_storeu(u32 *memory, LaneU32 value) {
+  _mm256_storeu_si256((__m256i *)memory, value);
+}
+static inline LaneU32 lane_u32_and(LaneU32 a, LaneU32 b) {
+  return _mm256_and_si256(a, b);
+}
+static inline LaneU32 lane_u32_or(LaneU32 a, LaneU32 b) {
+  return _mm256_or_si256(a, b);
+}
+#define lane_u32_shift_left(a, bits) _mm256_slli_epi32(a, bits)
+#define lane_u32_shift_right(a, bits) _mm256_srli_epi32(a, bits)
+// Rounds to nearest. Values must fit in 31 bits.
+static inline LaneU32 lane_u32_from_f32(LaneF32 a) {
+  return _mm256_cvtps_epi32(a);
+}
+static inline LaneF32 lane_f32_from_u32(LaneU32 a) {
+  return _mm256_cvtepi32_ps(a);
+}
+// Widens LANE_WIDTH bytes, unaligned, to one u32 per lane.
+static inline LaneU32 lane_u32_load_u8(const u8 *memory) {
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)memory));
+}
+#else
+#define LANE_WIDTH 4
+typedef __m128 LaneF32;
+typedef __m128i LaneU32;
+
+static inline LaneF32 lane_f32(float value) { return _mm_set1_ps(value); }
+static inline LaneF32 lane_f32_load(const float *memory) {
+  return _mm_load_ps(memory);
+}
+static inline void lane_f32_store(float *memory, LaneF32 value) {
+  _mm_store_ps(memory, value);
+}
+static inline LaneF32 lane_f32_loadu(const float *memory) {
+  return _mm_loadu_ps(memory);
+}
+static inline void lane_f32_storeu(float *memory, LaneF32 value) {
+  _mm_storeu_ps(memory, value);
+}
+static inline LaneF32 lane_f32_add(LaneF32 a, LaneF32 b) {
+  return _mm_add_ps(a, b);
+}
+static inline LaneF32 lane_f32_sub(LaneF32 a, LaneF32 b) {
+  return _mm_sub_ps(a, b);
+}
+static inline LaneF32 lane_f32_mul(LaneF32 a, LaneF32 b) {
+  return _mm_mul_ps(a, b);
+}
+static inline LaneF32 lane_f32_div(LaneF32 a, LaneF32 b) {
+  return _mm_div_ps(a, b);
+}
+static inline LaneF32 lane_f32_min(LaneF32 a, LaneF32 b) {
+  return _mm_min_ps(a, b);
+}
+static inline LaneF32 lane_f32_max(LaneF32 a, LaneF32 b) {
+  return _mm_max_ps(a, b);
+}
+static inline LaneF32 lane_f32_sqrt(LaneF32 a) { return _mm_sqrt_ps(a); }
+static inline LaneF32 lane_f32_less(LaneF32 a, LaneF32 b) {
+  return _mm_cmplt_ps(a, b);
+}
+static inline LaneF32 lane_f32_less_equal(LaneF32 a, LaneF32 b) {
+  return _mm_cmple_ps(a, b);
+}
+static inline LaneF32 lane_f32_greater(LaneF32 a, LaneF32 b) {
+  return _mm_cmpgt_ps(a, b);
+}
+static inline LaneF32 lane_mask_and(LaneF32 a, LaneF32 b) {
+  return _mm_and_ps(a, b);
+}
+static inline LaneF32 lane_mask_or(LaneF32 a, LaneF32 b) {
+  return _mm_or_ps(a, b);
+}
+// mask ? a : b
+static inline LaneF32 lane_f32_select(LaneF32 mask, LaneF32 a, LaneF32 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+// One bit per lane, set where the mask is true.
+static inline int lane_mask_bits(LaneF32 mask) { return _mm_movemask_ps(mask); }
+
+static inline LaneU32 lane_u32(u32 value) { return _mm_set1_epi32((int)value); }
+static inline LaneU32 lane_u32_load(const u32 *memory) {
+  return _mm_load_si128((const __m128i *)memory);
+}
+static inline LaneU32 lane_u32_loadu(const u32 *memory) {
+  return _mm_loadu_si128((const __m128i *)memory);
+}
+static inline void lane_u32_store(u32 *memory, LaneU32 value) {
+  _mm_store_si128((__m128i *)memory, value);
+}
+static inline void lane_u32_storeu(u32 *memory, LaneU32 value) {
+  _mm_storeu_si128((__m128i *)memory, value);
+}
+static inline LaneU32 lane_u32_and(LaneU32 a, LaneU32 b) {
+  return _mm_and_si128(a, b);
+}
+static inline LaneU32 lane_u32_or(LaneU32 a, LaneU32 b) {
+  return _mm_or_si128(a, b);
+}
+#define lane_u32_shift_left(a, bits) _mm_slli_epi32(a, bits)
+#define lane_u32_shift_right(a, bits) _mm_srli_epi32(a, bits)
+// Rounds to nearest. Values must fit in 31 bits.
+static inline LaneU32 lane_u32_from_f32(LaneF32 a) {
+  return _mm_cvtps_epi32(a);
+}
+static inline LaneF32 lane_f32_from_u32(LaneU32 a) {
+  return _mm_cvtepi32_ps(a);
+}
+// Widens LANE_WIDTH bytes, unaligned, to one u32 per lane.
+static inline LaneU32 lane_u32_load_u8(const u8 *memory) {
+  int bytes;
+  memcpy(&bytes, memory, sizeof(bytes));
+  __m128i zero = _mm_setzero_si128();
+  __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+  return _mm_unpacklo_epi16(words, zero);
+}
+#endif
+
+#define LANE_MASK_ALL ((1 << LANE_WIDTH) - 1)
+
+static inline LaneF32 lane_f32_clamp01(LaneF32 a) {
+  return lane_f32_min(lane_f32_max(a, lane_f32(0.0f)), lane_f32(1.0f));
+}
 
-V4 v4(float r, float g, float b, float a);
+static inline LaneF32 lane_f32_lerp(LaneF32 a, LaneF32 t, LaneF32 b) {
+  return lane_f32_add(a, lane_f32_mul(t, lane_f32_sub(b, a)));
+}
 
-V4 v4_mul(V4 v4, float scaler);
+// Unpacks one 8 bit channel of 0xAARRGGBB pixels into 0..255 floats.
+#define lane_unpack_channel(pixels, shift) \
+  lane_f32_from_u32(                       \
+      lane_u32_and(lane_u32_shift_right(pixels, shift), lane_u32(0xFF)))
 
-V4 v4_add(V4 a, V4 b);
\ No newline at end of file
+// Packs 0..255 float channels into 0xAARRGGBB pixels.
+static inline LaneU32 lane_pack_color(LaneF32 r, LaneF32 g, LaneF32 b,
+                                      LaneF32 a) {
+  LaneU32 result = lane_u32_from_f32(b);
+  result = lane_u32_or(result, lane_u32_shift_left(lane_u32_from_f32(g), 8));
+  result = lane_u32_or(result, lane_u32_shift_left(lane_u32_from_f32(r), 16));
+  result = lane_u32_or(result, lane_u32_shift_left(lane_u32_from_f32(a), 24));
+  return result;
+}
@@ -0,0 +1,211 @@
+#include "./memory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../atomics.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#define PAGE_SIZE 4096
+
+#ifdef _WIN32
+void *page_alloc(size_t size) {
+  return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void page_free(void *memory) {
+  if (memory) VirtualFree(memory, 0, MEM_RELEASE);
+}
+#else
+void *page_alloc(size_t size) {
+  size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+  void *result = aligned_alloc(PAGE_SIZE, size);
+  if (result) memset(result, 0, size);
+  return result;
+}
+
+void page_free(void *memory) { free(memory); }
+#endif
+
+#if MEMORY_TRACKING
+typedef enum AllocationKind {
+  ALLOCATION_HEAP,
+  ALLOCATION_PAGES,
+} AllocationKind;
+
+// Sits right in front of every tracked allocation and links it into the list
+// of live allocations used for the leak report.
+typedef struct AllocationHeader {
+  struct AllocationHeader *prev;
+  struct AllocationHeader *next;
+  size_t size;
+  const char *file;
+  int line;
+  MemoryTag tag;
+  AllocationKind kind;
+} AllocationHeader;
+
+// NOTE: Padded so heap allocations keep malloc's 16 byte alignment.
+#define HEADER_SIZE ((sizeof(AllocationHeader) + 15) & ~15)
+
+typedef struct MemoryTracker {
+  volatile s32 lock;
+  AllocationHeader *live;
+  MemoryStats stats[MEMORY_TAG_COUNT];
+} MemoryTracker;
+
+static MemoryTracker global_memory;
+
+static const char *tag_names[MEMORY_TAG_COUNT] = {
+    [MEMORY_TAG_RENDER] = "render", [MEMORY_TAG_FONT] = "font",
+    [MEMORY_TAG_IO] = "io",         [MEMORY_TAG_GUI] = "gui",
+    [MEMORY_TAG_GAME] = "game",     [MEMORY_TAG_JOBS] = "jobs",
+    [MEMORY_TAG_NAV] = "nav",       [MEMORY_TAG_AUDIO] = "audio",
+};
+
+static void tracker_lock() {
+  while (!atomic_compare_exchange_s32(&global_memory.lock, 0, 1)) cpu_pause();
+}
+
+static void tracker_unlock() { atomic_store_s32(&global_memory.lock, 0); }
+
+static void debug_output(const char *text) {
+#ifdef _WIN32
+  OutputDebugStringA(text);
+#else
+  fputs(text, stderr);
+#endif
+}
+
+static void *track(AllocationHeader *header, MemoryTag tag, size_t size,
+                   const char *file, int line, AllocationKind kind) {
+  assert(tag < MEMORY_TAG_COUNT);
+  header->size = size;
+  header->file = file;
+  header->line = line;
+  header->tag = tag;
+  header->kind = kind;
+  header->prev = 0;
+
+  tracker_lock();
+  header->next = global_memory.live;
+  if (global_memory.live) global_memory.live->prev = header;
+  global_memory.live = header;
+
+  MemoryStats *stats = &global_memory.stats[tag];
+  stats->current += size;
+  stats->peak = MAX(stats->peak, stats->current);
+  stats->count++;
+  stats->total_count++;
+  tracker_unlock();
+
+  return (char *)header + HEADER_SIZE;
+}
+
+static AllocationHeader *untrack(void *memory, AllocationKind kind) {
+  AllocationHeader *header =
+      (AllocationHeader *)((char *)memory - HEADER_SIZE);
+  // Freeing with the wrong function is a bug.
+  assert(header->kind == kind);
+
+  tracker_lock();
+  if (header->prev) header->prev->next = header->next;
+  if (header->next) header->next->prev = header->prev;
+  if (global_memory.live == header) global_memory.live = header->next;
+
+  MemoryStats *stats = &global_memory.stats[header->tag];
+  stats->current -= header->size;
+  stats->count--;
+  tracker_unlock();
+
+  return header;
+}
+
+void *memory_alloc(MemoryTag tag, size_t size, const char *file, int line) {
+  AllocationHeader *header = (AllocationHeader *)malloc(HEADER_SIZE + size);
+  if (!header) return 0;
+  return track(header, tag, size, file, line, ALLOCATION_HEAP);
+}
+
+void memory_free(void *memory) {
+  if (!memory) return;
+  free(untrack(memory, ALLOCATION_HEAP));
+}
+
+// NOTE: Page allocations spend one extra page so the header can sit at the
+// end of it and the memory handed out stays page aligned.
+void *memory_virtual_alloc(MemoryTag tag, size_t size, const char *file,
+                           int line) {
+  char *pages = (char *)page_alloc(PAGE_SIZE + size);
+  if (!pages) return 0;
+  AllocationHeader *header =
+      (AllocationHeader *)(pages + PAGE_SIZE - HEADER_SIZE);
+  return track(header, tag, size, file, line, ALLOCATION_PAGES);
+}
+
+void memory_virtual_free(void *memory) {
+  if (!memory) return;
+  untrack(memory, ALLOCATION_PAGES);
+  page_free((char *)memory - PAGE_SIZE);
+}
+
+const char *memory_tag_name(MemoryTag tag) { return tag_names[tag]; }
+
+MemoryStats memory_get_stats(MemoryTag tag) {
+  tracker_lock();
+  MemoryStats result = global_memory.stats[tag];
+  tracker_unlock();
+  return result;
+}
+
+MemoryStats memory_get_total_stats() {
+  MemoryStats result = {0};
+  tracker_lock();
+  for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    MemoryStats *stats = &global_memory.stats[tag];
+    result.current += stats->current;
+    // NOTE: Subsystems don't peak at the same time, so this is an upper bound.
+    result.peak += stats->peak;
+    result.count += stats->count;
+    result.total_count += stats->total_count;
+  }
+  tracker_unlock();
+  return result;
+}
+
+u32 memory_report_leaks() {
+  char line[512];
+  u32 leaks = 0;
+  size_t leaked_bytes = 0;
+
+  tracker_lock();
+  for (AllocationHeader *header = global_memory.live; header;
+       header = header->next) {
+    // NOTE: "file(line):" makes the line clickable in Visual Studio's output.
+    snprintf(line, sizeof(line), "%s(%d): leaked %zu bytes [%s]\n",
+             header->file, header->line, header->size,
+             tag_names[header->tag]);
+    debug_output(line);
+    leaks++;
+    leaked_bytes += header->size;
+  }
+  for (int tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    MemoryStats *stats = &global_memory.stats[tag];
+    snprintf(line, sizeof(line),
+             "memory [%s]: peak %zu bytes, %u allocations, %zu bytes in %u "
+             "leaked\n",
+             tag_names[tag], stats->peak, stats->total_count, stats->current,
+             stats->count);
+    debug_output(line);
+  }
+  tracker_unlock();
+
+  snprintf(line, sizeof(line), "memory: %u leaks, %zu bytes\n", leaks,
+           leaked_bytes);
+  debug_output(line);
+  return leaks;
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "../common.h"
+
+// Every allocation is charged to the subsystem that owns it.
+typedef enum MemoryTag {
+  MEMORY_TAG_RENDER,
+  MEMORY_TAG_FONT,
+  MEMORY_TAG_IO,
+  MEMORY_TAG_GUI,
+  MEMORY_TAG_GAME,
+  MEMORY_TAG_JOBS,
+  MEMORY_TAG_NAV,
+  MEMORY_TAG_AUDIO,
+  MEMORY_TAG_COUNT,
+} MemoryTag;
+
+// NOTE: Tracking is only compiled into debug builds. In release builds the
+// allocation macros below are the plain allocators and everything else
+// disappears.
+#ifndef MEMORY_TRACKING
+#ifdef _DEBUG
+#define MEMORY_TRACKING 1
+#else
+#define MEMORY_TRACKING 0
+#endif
+#endif
+
+typedef struct MemoryStats {
+  // Bytes the subsystem asked for, not counting tracking overhead.
+  size_t current;
+  size_t peak;
+  // Live allocations, and allocations ever made.
+  u32 count;
+  u32 total_count;
+} MemoryStats;
+
+// mem_alloc/mem_free wrap malloc/free, mem_virtual_alloc/mem_virtual_free
+// wrap page allocations (VirtualAlloc on Windows), which come back zeroed and
+// page aligned.
+#if MEMORY_TRACKING
+#define mem_alloc(tag, size) memory_alloc(tag, size, __FILE__, __LINE__)
+#define mem_free(memory) memory_free(memory)
+#define mem_virtual_alloc(tag, size) \
+  memory_virtual_alloc(tag, size, __FILE__, __LINE__)
+#define mem_virtual_free(memory) memory_virtual_free(memory)
+
+void *memory_alloc(MemoryTag tag, size_t size, const char *file, int line);
+void memory_free(void *memory);
+void *memory_virtual_alloc(MemoryTag tag, size_t size, const char *file,
+                           int line);
+void memory_virtual_free(void *memory);
+
+const char *memory_tag_name(MemoryTag tag);
+MemoryStats memory_get_stats(MemoryTag tag);
+MemoryStats memory_get_total_stats();
+
+// Writes every allocation that is still live, with the file and line that
+// made it, to the debug output. Returns the number of leaked allocations.
+u32 memory_report_leaks();
+#else
+#define mem_alloc(tag, size) malloc(size)
+#define mem_free(memory) free(memory)
+#define mem_virtual_alloc(tag, size) page_alloc(size)
+#define mem_virtual_free(memory) page_free(memory)
+#define memory_report_leaks() 0
+#endif
+
+void *page_alloc(size_t size);
+void page_free(void *memory);
@@ -0,0 +1,348 @@
+#include "./nav.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../memory/memory.h"
+
+#define NOT_QUEUED 0xFFFFFFFF
+
+static const int neighbor_x[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+static const int neighbor_y[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+static const u32 neighbor_cost[8] = {
+    NAV_STRAIGHT_COST, NAV_STRAIGHT_COST, NAV_STRAIGHT_COST,
+    NAV_STRAIGHT_COST, NAV_DIAGONAL_COST, NAV_DIAGONAL_COST,
+    NAV_DIAGONAL_COST, NAV_DIAGONAL_COST,
+};
+
+//
+// Heap
+//
+
+static void heap_swap(NavHeap *heap, u32 a, u32 b) {
+  u32 cell_a = heap->cells[a];
+  u32 cell_b = heap->cells[b];
+  heap->cells[a] = cell_b;
+  heap->cells[b] = cell_a;
+  heap->position[cell_b] = a;
+  heap->position[cell_a] = b;
+}
+
+static void heap_sift_up(NavHeap *heap, u32 i) {
+  while (i > 0) {
+    u32 parent = (i - 1) / 2;
+    if (heap->key[heap->cells[parent]] <= heap->key[heap->cells[i]]) break;
+    heap_swap(heap, i, parent);
+    i = parent;
+  }
+}
+
+static void heap_sift_down(NavHeap *heap, u32 i) {
+  while (true) {
+    u32 smallest = i;
+    u32 left = 2 * i + 1;
+    u32 right = left + 1;
+    if (left < heap->count &&
+        heap->key[heap->cells[left]] < heap->key[heap->cells[smallest]])
+      smallest = left;
+    if (right < heap->count &&
+        heap->key[heap->cells[right]] < heap->key[heap->cells[smallest]])
+      smallest = right;
+    if (smallest == i) break;
+    heap_swap(heap, i, smallest);
+    i = smallest;
+  }
+}
+
+// Queues cell, or moves it up if it is already queued and its key dropped.
+static void heap_push_or_decrease(NavHeap *heap, u32 cell) {
+  if (heap->position[cell] == NOT_QUEUED) {
+    heap->position[cell] = heap->count;
+    heap->cells[heap->count++] = cell;
+  }
+  heap_sift_up(heap, heap->position[cell]);
+}
+
+static u32 heap_pop(NavHeap *heap) {
+  u32 result = heap->cells[0];
+  heap_swap(heap, 0, --heap->count);
+  heap->position[result] = NOT_QUEUED;
+  heap_sift_down(heap, 0);
+  return result;
+}
+
+// Empties the heap, leaving every cell marked as not queued.
+static void heap_clear(NavHeap *heap) {
+  for (u32 i = 0; i < heap->count; i++) {
+    heap->position[heap->cells[i]] = NOT_QUEUED;
+  }
+  heap->count = 0;
+}
+
+//
+// Grid
+//
+
+static bool is_walkable(NavGrid *grid, int x, int y) {
+  s32 cell = nav_cell(grid, x, y);
+  return cell >= 0 && grid->walkable[cell];
+}
+
+// Whether an agent on (x, y) can step to neighbor n. Diagonal steps need
+// both tiles they pass between to be open.
+static bool can_step(NavGrid *grid, int x, int y, int n) {
+  int dx = neighbor_x[n];
+  int dy = neighbor_y[n];
+  if (!is_walkable(grid, x + dx, y + dy)) return false;
+  if (dx && dy) {
+    return is_walkable(grid, x + dx, y) && is_walkable(grid, x, y + dy);
+  }
+  return true;
+}
+
+void init_nav_grid(NavGrid *grid, int width, int height, int tile_size) {
+  u32 cell_count = (u32)(width * height);
+  // fields, heap cells, heap positions, then walkable.
+  size_t u32_count = (NAV_MAX_FIELDS + 2) * (size_t)cell_count;
+  u32 *memory = (u32 *)mem_alloc(MEMORY_TAG_NAV,
+                                 u32_count * sizeof(u32) + cell_count);
+  assert(memory);
+
+  *grid = (NavGrid){
+      .width = width,
+      .height = height,
+      .tile_size = tile_size,
+      .cell_count = cell_count,
+      .memory = memory,
+  };
+  for (int i = 0; i < NAV_MAX_FIELDS; i++) {
+    grid->fields[i].distance = memory + i * cell_count;
+  }
+  grid->heap.cells = memory + NAV_MAX_FIELDS * cell_count;
+  grid->heap.position = grid->heap.cells + cell_count;
+  grid->walkable = (u8 *)(grid->heap.position + cell_count);
+  memset(grid->heap.position, 0xFF, cell_count * sizeof(u32));
+  memset(grid->walkable, 1, cell_count);
+}
+
+void free_nav_grid(NavGrid *grid) {
+  mem_free(grid->memory);
+  grid->memory = 0;
+  grid->field_count = 0;
+}
+
+//
+// Flow fields
+//
+
+// Dijkstra from whatever is queued, lowering distances until nothing
+// improves.
+static void relax_field(NavGrid *grid, NavFlowField *field) {
+  NavHeap *heap = &grid->heap;
+  heap->key = field->distance;
+  while (heap->count) {
+    u32 cell = heap_pop(heap);
+    int x = cell % grid->width;
+    int y = cell / grid->width;
+    for (int n = 0; n < 8; n++) {
+      if (!can_step(grid, x, y, n)) continue;
+      u32 next = cell + neighbor_y[n] * grid->width + neighbor_x[n];
+      u32 distance = field->distance[cell] + neighbor_cost[n];
+      if (distance < field->distance[next]) {
+        field->distance[next] = distance;
+        heap_push_or_decrease(heap, next);
+      }
+    }
+  }
+}
+
+static void build_field(NavGrid *grid, NavFlowField *field, s32 goal) {
+  field->goal = goal;
+  field->dirty = false;
+  memset(field->distance, 0xFF, grid->cell_count * sizeof(u32));
+  if (!grid->walkable[goal]) return;
+  field->distance[goal] = 0;
+  grid->heap.key = field->distance;
+  heap_push_or_decrease(&grid->heap, goal);
+  relax_field(grid, field);
+}
+
+// Opening a tile can only make distances shorter: it adds the tile itself and
+// the diagonal steps it was blocking between its neighbors. So every reached
+// cell around it is requeued and Dijkstra carries the improvements outward.
+static void repair_opened_tile(NavGrid *grid, NavFlowField *field, int x,
+                               int y) {
+  s32 opened = nav_cell(grid, x, y);
+  if (opened == field->goal) field->distance[opened] = 0;
+  grid->heap.key = field->distance;
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      s32 cell = nav_cell(grid, x + dx, y + dy);
+      if (cell < 0 || field->distance[cell] == NAV_UNREACHABLE) continue;
+      heap_push_or_decrease(&grid->heap, cell);
+    }
+  }
+  relax_field(grid, field);
+}
+
+void nav_set_walkable(NavGrid *grid, int x, int y, bool walkable) {
+  s32 cell = nav_cell(grid, x, y);
+  assert(cell >= 0);
+  if (grid->walkable[cell] == walkable) return;
+  grid->walkable[cell] = walkable;
+
+  for (u32 i = 0; i < grid->field_count; i++) {
+    NavFlowField *field = &grid->fields[i];
+    if (field->dirty) continue;
+    if (walkable) {
+      repair_opened_tile(grid, field, x, y);
+    } else if (field->distance[cell] != NAV_UNREACHABLE) {
+      // NOTE: Blocking can make distances longer anywhere downstream of the
+      // tile, which Dijkstra can't undo in place. If the tile was never
+      // reached the field didn't route through it and stays valid.
+      field->dirty = true;
+    }
+  }
+}
+
+NavFlowField *nav_flow_field(NavGrid *grid, s32 goal) {
+  assert(goal >= 0 && (u32)goal < grid->cell_count);
+  NavFlowField *result = 0;
+  for (u32 i = 0; i < grid->field_count; i++) {
+    if (grid->fields[i].goal == goal) {
+      result = &grid->fields[i];
+      break;
+    }
+  }
+
+  if (!result) {
+    if (grid->field_count < NAV_MAX_FIELDS) {
+      result = &grid->fields[grid->field_count++];
+    } else {
+      result = &grid->fields[0];
+      for (u32 i = 1; i < grid->field_count; i++) {
+        if (grid->fields[i].last_used < result->last_used) {
+          result = &grid->fields[i];
+        }
+      }
+    }
+    result->dirty = true;
+  }
+
+  if (result->dirty) build_field(grid, result, goal);
+  result->last_used = grid->frame;
+  return result;
+}
+
+s32 nav_flow_step(NavGrid *grid, NavFlowField *field, s32 cell) {
+  u32 best_distance = field->distance[cell];
+  if (best_distance == NAV_UNREACHABLE) return cell;
+
+  s32 result = cell;
+  int x = cell % grid->width;
+  int y = cell / grid->width;
+  for (int n = 0; n < 8; n++) {
+    if (!can_step(grid, x, y, n)) continue;
+    s32 next = cell + neighbor_y[n] * grid->width + neighbor_x[n];
+    u32 distance = field->distance[next];
+    if (distance < best_distance) {
+      best_distance = distance;
+      result = next;
+    }
+  }
+  return result;
+}
+
+void nav_next_frame(NavGrid *grid) { grid->frame++; }
+
+//
+// A*
+//
+
+void init_nav_pathfinder(NavPathfinder *pathfinder, NavGrid *grid) {
+  u32 cell_count = grid->cell_count;
+  // cost, estimate, parent, seen, heap cells, heap positions.
+  u32 *memory = (u32 *)mem_alloc(MEMORY_TAG_NAV, 6 * sizeof(u32) * cell_count);
+  assert(memory);
+
+  *pathfinder = (NavPathfinder){
+      .cell_count = cell_count,
+      .cost = memory,
+      .estimate = memory + cell_count,
+      .parent = (s32 *)(memory + 2 * cell_count),
+      .seen = memory + 3 * cell_count,
+      .heap = {.cells = memory + 4 * cell_count,
+               .position = memory + 5 * cell_count},
+      .memory = memory,
+  };
+  pathfinder->heap.key = pathfinder->estimate;
+  memset(pathfinder->seen, 0, cell_count * sizeof(u32));
+  memset(pathfinder->heap.position, 0xFF, cell_count * sizeof(u32));
+}
+
+void free_nav_pathfinder(NavPathfinder *pathfinder) {
+  mem_free(pathfinder->memory);
+  pathfinder->memory = 0;
+}
+
+// Octile distance, which never overestimates with 8-connected movement.
+static u32 heuristic(NavGrid *grid, s32 from, s32 to) {
+  int dx = abs(from % grid->width - to % grid->width);
+  int dy = abs(from / grid->width - to / grid->width);
+  return NAV_STRAIGHT_COST * (dx + dy) +
+         (NAV_DIAGONAL_COST - 2 * NAV_STRAIGHT_COST) * MIN(dx, dy);
+}
+
+u32 nav_find_path(NavGrid *grid, NavPathfinder *pathfinder, s32 start,
+                  s32 goal, s32 *path, u32 max_length) {
+  assert(pathfinder->cell_count == grid->cell_count);
+  if (start < 0 || goal < 0) return 0;
+  if (!grid->walkable[start] || !grid->walkable[goal]) return 0;
+
+  u32 search = ++pathfinder->search;
+  if (!search) {
+    // NOTE: The stamp wrapped, so old stamps could look current again.
+    memset(pathfinder->seen, 0, pathfinder->cell_count * sizeof(u32));
+    search = pathfinder->search = 1;
+  }
+
+  NavHeap *heap = &pathfinder->heap;
+  pathfinder->seen[start] = search;
+  pathfinder->cost[start] = 0;
+  pathfinder->estimate[start] = heuristic(grid, start, goal);
+  pathfinder->parent[start] = -1;
+  heap_push_or_decrease(heap, start);
+
+  // NOTE: The heuristic is consistent, so a popped cell's cost is final and
+  // never improves. Closed cells fail the cost check without a closed set.
+  while (heap->count) {
+    u32 cell = heap_pop(heap);
+    if ((s32)cell == goal) break;
+    int x = cell % grid->width;
+    int y = cell / grid->width;
+    for (int n = 0; n < 8; n++) {
+      if (!can_step(grid, x, y, n)) continue;
+      u32 next = cell + neighbor_y[n] * grid->width + neighbor_x[n];
+      u32 cost = pathfinder->cost[cell] + neighbor_cost[n];
+      if (pathfinder->seen[next] == search && cost >= pathfinder->cost[next])
+        continue;
+      pathfinder->seen[next] = search;
+      pathfinder->cost[next] = cost;
+      pathfinder->estimate[next] = cost + heuristic(grid, next, goal);
+      pathfinder->parent[next] = cell;
+      heap_push_or_decrease(heap, next);
+    }
+  }
+  heap_clear(heap);
+
+  if (pathfinder->seen[goal] != search) return 0;
+  u32 length = 0;
+  for (s32 cell = goal; cell >= 0; cell = pathfinder->parent[cell]) length++;
+  if (length > max_length) return 0;
+
+  u32 i = length;
+  for (s32 cell = goal; cell >= 0; cell = pathfinder->parent[cell]) {
+    path[--i] = cell;
+  }
+  return length;
+}
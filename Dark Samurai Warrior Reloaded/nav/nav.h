@@ -0,0 +1,114 @@
+#pragma once
+#include <stdbool.h>
+
+#include "../common.h"
+#include "../math.h"
+
+// NOTE: The world is split into square tiles of tile_size pixels, with tile
+// (0, 0) in the bottom left like the backbuffer. Cells are indexed
+// y * width + x and movement is 8-connected. Diagonal steps cost
+// NAV_DIAGONAL_COST and can't cut the corner of a blocked tile.
+#define NAV_STRAIGHT_COST 10
+#define NAV_DIAGONAL_COST 14
+#define NAV_UNREACHABLE 0xFFFFFFFF
+#define NAV_MAX_FIELDS 8
+
+// A binary min-heap of cells ordered by key[cell]. position lets a queued
+// cell's key be lowered in place instead of pushing it twice.
+typedef struct NavHeap {
+  u32* cells;
+  u32* position;
+  u32* key;
+  u32 count;
+} NavHeap;
+
+// Distance to goal from every cell, built with one Dijkstra pass and shared
+// by every agent heading to the same goal.
+typedef struct NavFlowField {
+  s32 goal;
+  u32* distance;
+  // Set when a tile changed in a way the field can't repair, so it gets
+  // rebuilt the next time it is asked for.
+  bool dirty;
+  u32 last_used;
+} NavFlowField;
+
+typedef struct NavGrid {
+  int width;
+  int height;
+  int tile_size;
+  u32 cell_count;
+  u8* walkable;
+
+  NavFlowField fields[NAV_MAX_FIELDS];
+  u32 field_count;
+  u32 frame;
+  // Scratch for field builds and repairs.
+  NavHeap heap;
+
+  void* memory;
+} NavGrid;
+
+// Per-agent A* state. The pools are sized for the grid once, and every search
+// bumps search instead of clearing them.
+typedef struct NavPathfinder {
+  u32 cell_count;
+  u32 search;
+  u32* cost;
+  u32* estimate;
+  s32* parent;
+  // Cells whose seen stamp isn't the current search haven't been reached yet
+  // and their cost is stale.
+  u32* seen;
+  NavHeap heap;
+  void* memory;
+} NavPathfinder;
+
+// Every tile starts out walkable.
+void init_nav_grid(NavGrid* grid, int width, int height, int tile_size);
+
+void free_nav_grid(NavGrid* grid);
+
+static inline s32 nav_cell(NavGrid* grid, int x, int y) {
+  if (x < 0 || y < 0 || x >= grid->width || y >= grid->height) return -1;
+  return y * grid->width + x;
+}
+
+// Cell under a world position in pixels, or -1 off the grid.
+static inline s32 nav_cell_at(NavGrid* grid, V2 pos) {
+  return nav_cell(grid, (int)(pos.x / grid->tile_size),
+                  (int)(pos.y / grid->tile_size));
+}
+
+// Center of a cell in pixels.
+static inline V2 nav_cell_center(NavGrid* grid, s32 cell) {
+  float half = grid->tile_size * 0.5f;
+  return v2((cell % grid->width) * (float)grid->tile_size + half,
+            (cell / grid->width) * (float)grid->tile_size + half);
+}
+
+// Updates the tile and the cached flow fields it affects. Opening a tile is
+// repaired in place; blocking one marks the fields that could route through
+// it dirty.
+void nav_set_walkable(NavGrid* grid, int x, int y, bool walkable);
+
+// Returns the cached field for goal, building it if it is missing or dirty.
+// Call once per goal per frame and share the result between agents.
+NavFlowField* nav_flow_field(NavGrid* grid, s32 goal);
+
+// The neighbor of cell that is one step closer to the field's goal, or cell
+// itself at the goal or where the goal can't be reached.
+s32 nav_flow_step(NavGrid* grid, NavFlowField* field, s32 cell);
+
+// Call once a frame so the field cache can evict the least recently used.
+void nav_next_frame(NavGrid* grid);
+
+void init_nav_pathfinder(NavPathfinder* pathfinder, NavGrid* grid);
+
+void free_nav_pathfinder(NavPathfinder* pathfinder);
+
+// Writes the cells from start to goal, both included, into path and returns
+// how many there are. Returns 0 if there is no path or it doesn't fit in
+// max_length.
+u32 nav_find_path(NavGrid* grid, NavPathfinder* pathfinder, s32 start,
+                  s32 goal, s32* path, u32 max_length);